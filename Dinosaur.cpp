@@ -1,6 +1,18 @@
-// compile with: clang++ -std=c++20 -Wall -Werror -Wextra -Wpedantic -g3 -o FinalProject FinalProject.cpp
+// compile with: clang++ -std=c++20 -Wall -Werror -Wextra -Wpedantic -g3 -O2 -pthread -o FinalProject FinalProject.cpp
 // run with: ./fishies 2> /dev/null
 // run with: ./fishies 2> debugoutput.txt
+// run without a terminal with: ./fishies --headless --rows 60 --cols 200 --ticks 1000000 --input " zzzzzzzz"
+// play a million games on every core with: ./fishies --batch 1000000 (add --input " zzzzz" to play a script instead of the bot)
+// load it up with: ./fishies --headless --clouds 100000 --obstacles 1000 --ticks 10000
+// time the hot functions with: ./fishies --bench
+// see where each tick goes with: ./fishies --profile ticks.json and open ticks.json in https://ui.perfetto.dev
+// record a game with: ./fishies --seed 42 --record game.trc and play it back with: ./fishies --replay game.trc
+// play a level that never ends with: ./fishies --endless (it works with --headless and --batch too)
+// keep a video of a game with: ./fishies --cast game.cast and watch it with: asciinema play game.cast
+// race each other with: ./fishies --serve /tmp/dino.sock and in other terminals: ./fishies --join /tmp/dino.sock (add --headless for a bot)
+// let other people watch with: ./fishies --broadcast finals and in their terminals: ./fishies --spectate finals
+// let the game play itself with: ./fishies --autopilot (it works with --headless, --batch and a --join bot too)
+// make a long level with: ./fishies --make-level long.lvl --level-length 100000000 and play it with: ./fishies --level long.lvl
 //  "2>" redirect standard error (STDERR; cerr)
 //  /dev/null is a "virtual file" which discard contents
 
@@ -12,14 +24,39 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <span>
+#include <array>
+#include <algorithm>
 #include <random>
 #include <chrono>    // for dealing with time intervals
 #include <cmath>     // for max() and min()
 #include <termios.h> // to control terminal modes
 #include <unistd.h>  // for read()
 #include <fcntl.h>   // to enable / disable non-blocking read()
+#include <poll.h>    // to sleep until there is input or a tick is due
+#include <sys/timerfd.h>
+#include <sys/eventfd.h> // to wake the input thread up when the game ends
+#include <sys/ioctl.h>   // to ask for the size of the terminal
+#include <csignal>       // to hear about the terminal being resized
 #include <stdlib.h>
-#include <experimental/random>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <new>
+#include <cstring>
+#include <iterator>
+#include <climits>
+#include <bit> // for countr_zero
+#include <thread>
+#include <functional> // for ref() when starting threads
+#include <cerrno>
+#include <sys/mman.h> // to map level files instead of reading them
+#include <sys/stat.h>
+#include <sys/socket.h> // for races over a unix socket
+#include <sys/un.h>
+#include "DinosaurEnv.h" // the batch of environments for training, see dinosaurCreate
 
 // Because we are only using #includes from the standard, names shouldn't conflict
 using namespace std;
@@ -56,6 +93,7 @@ const unsigned int COLOUR_BLUE{34};
 const unsigned int COLOUR_MAGENTA{35};
 const unsigned int COLOUR_CYAN{36};
 const unsigned int COLOUR_WHITE{37};
+const unsigned int COLOUR_BRIGHT_RED{91};
 
 const unsigned short MOVING_NOWHERE{0};
 const unsigned short MOVING_LEFT{1};
@@ -63,23 +101,155 @@ const unsigned short MOVING_RIGHT{2};
 const unsigned short MOVING_UP{3};
 const unsigned short MOVING_DOWN{4};
 
+const int PLAYER_SCORING_LEFT{5}; //collisions use the real shape of the sprites (see spritesOverlap), this is just how far back the player's scoring area starts
+const unsigned int OBSTACLE_FASTEST{6}; //the most columns an obstacle can move in a tick
+
+const int SCREEN_MIN_ROWS{30}; //the smallest terminal the game can be played on
+const int SCREEN_MIN_COLS{100};
+const chrono::milliseconds TERMINAL_REPLY_TIMEOUT{250}; //how long to wait for the terminal to say where the cursor is, when the size can't be asked for directly
+
+const int OBSTACLE_PARKED{INT_MAX / 2}; //the column of an obstacle slot that endless mode isn't using. It sorts after every real obstacle, and is never drawn, hit or moved
+const unsigned int CHUNK_TICKS{100};    //each chunk of an endless level brings in what arrives over this many ticks
+const size_t CHUNK_SPAWNS{64};          //the most obstacles and clouds a chunk can have
+const uint64_t CHUNK_SLOTS{4};          //chunks the level worker can have made ahead of the one being played
+const unsigned int CHUNK_LEAD_IN{20};   //ticks at the start of the first chunk with nothing in them, so there is a moment to get ready
+const unsigned char SPAWN_OBSTACLE{0};  //kinds of chunkspawn
+const unsigned char SPAWN_CLOUD{1};
+const char LEVEL_MAGIC[8]{'D', 'I', 'N', 'O', 'L', 'V', 'L', '1'};
+const size_t LEVEL_INDEX_STRIDE{64}; //entities per entry in a level's sparse index. Finding a column is a binary search of the index and then a look through at most this many
+const int LEVEL_SCROLL{2};           //columns the camera moves along a level every tick, so it is how fast everything in the level comes at the player
+const int LEVEL_LEAD_IN{100};        //columns at the start of a made level with nothing in them
+
+const unsigned short GAME_RUNNING{0};
+const unsigned short GAME_LOST{1};
+const unsigned short GAME_WON{2};
+const unsigned short RACER_WATCHING{3}; //a racer that joined part way through a race and is waiting for the next one, alongside the GAME_ states
+const unsigned short RACER_EMPTY{4};    //a racer slot nobody is in
+
+const char TRACE_MAGIC[8]{'D', 'I', 'N', 'O', 'T', 'R', 'C', '3'};
+const unsigned char TRACE_INPUT{1}; //followed by the 1 byte of input used on that tick
+const unsigned char TRACE_HASH{2};  //followed by the 8 byte hashWorld() of the world after that tick
+const unsigned char TRACE_END{3};   //followed by 1 byte: the GAME_ state the game ended in, or GAME_RUNNING if the player quit
+const unsigned char TRACE_RESIZE{4}; //followed by 8 bytes: the new rows in the top 32 bits and columns in the bottom 32, applied before the next tick
+const unsigned int TRACE_HASH_INTERVAL{10}; //a hash every second of play is enough to find where a replay went wrong
+
+const int BENCH_ROWS[]{30, 60, 120}; //the screen sizes --bench runs at, BENCH_ROWS[i] by BENCH_COLS[i]
+const int BENCH_COLS[]{100, 200, 400};
+const unsigned int BENCH_CLOUDS[]{10, 1000, 100000}; //the entity counts --bench runs at, BENCH_CLOUDS[i] extra clouds with BENCH_OBSTACLES[i] obstacles
+const unsigned int BENCH_OBSTACLES[]{3, 100, 1000};
+const double BENCH_SECONDS{0.05};        //how long each function is timed for
+const int64_t BENCH_LEVEL_LENGTH{100000000}; //columns in the level viewLevel is timed on, which is millions of obstacles and clouds
+const double BENCH_BATCH_SECONDS{0.0001}; //batches are doubled until they take this long, so reading the clock is lost in the noise
+
+const unsigned char LOG_DEBUG{0}; //log levels, anything below the level picked with --log-level is thrown away before it is queued
+const unsigned char LOG_INFO{1};
+const unsigned char LOG_WARN{2};
+const unsigned char LOG_ERROR{3};
+const char *const LOG_LEVEL_NAMES[]{"DEBUG", "INFO", "WARN", "ERROR"};
+const unsigned char LOG_TICK{0};   //the line written every tick, see logTick
+const unsigned char LOG_TEXT{1};   //a message followed by [text]
+const unsigned char LOG_NUMBER{2}; //a message followed by [values[0]]
+const size_t LOG_SLOTS{1024};      //records the queue can hold before new ones are dropped, a power of 2 so the index is a mask
+const chrono::milliseconds LOG_FLUSH_INTERVAL{50}; //how long the writer thread sleeps between batches
+const double LOG_LINES_PER_SECOND{200}; //lines below LOG_WARN past this rate (with a burst of as many) are counted instead of written, so a flood of logging can't swamp the disk
+
+const uint64_t BATCH_RANGE_END{0xffffffff}; //the bits of a batchrange that hold where it ends, which is also the most games a batch can have
+const uint64_t BATCH_CHUNK{64};              //games a batch worker takes from its own range at a time
+const unsigned int BATCH_TICK_LIMIT{100000}; //a batch game still going after this many ticks is counted as out of time instead of won or lost
+const size_t BATCH_SCORE_BUCKETS{16};        //scores up to 14 get their own bucket, the last one counts everything higher
+const size_t BATCH_TIME_BUCKETS{30};         //seconds played before losing, one bucket per second and the last one for anything longer
+const int BOT_JUMP_GAP{2};                   //the bot jumps when the next obstacle is this many of its own moves away from the front of the player
+const int AUTOPILOT_HORIZON{32};             //ticks --autopilot looks ahead. The fastest obstacle crosses a screen 200 columns wide in less, even with the player jumping towards it
+const size_t JUMP_PHASES{7};                 //values t takes, from standing (0) through the 6 ticks of a jump
+const int JUMP_HIT_BIAS{16};                 //a cactus d columns right of the player is bit d + this of JUMP_HITS
+const uint32_t ENV_BENCH_GAMES{4096};        //games in the batch dinosaurStep is timed on, enough that every thread has plenty to do each step
+
+const size_t INPUT_QUEUE_SLOTS{256}; //keys that can be waiting for the next tick, a power of 2 so the index is a mask
+const unsigned char KEY_TEXT{0};     //kinds of inputevent. An ordinary key, which is in inputevent::key
+const unsigned char KEY_UP{1};       //the arrow keys, which arrive as escape sequences
+const unsigned char KEY_DOWN{2};
+const unsigned char KEY_RIGHT{3};
+const unsigned char KEY_LEFT{4};
+const unsigned char KEY_ESCAPE{5};   //escape pressed on its own
+const unsigned char KEY_UNKNOWN{6};  //an escape sequence the game has no use for, like a late answer to GetTerminalSize
+const unsigned char DECODE_TEXT{0};     //states of keydecoder: between keys
+const unsigned char DECODE_ESCAPE{1};   //just had an escape
+const unsigned char DECODE_SEQUENCE{2}; //inside an escape sequence, waiting for its final byte
+const chrono::milliseconds ESCAPE_TIMEOUT{25}; //an escape with nothing after it for this long was the escape key, terminals send a whole sequence at once
+const chrono::milliseconds JUMP_BUFFER{150};   //a jump pressed while the player can't jump yet is kept this long, so pressing just before landing still jumps
+const unsigned int FRAME_INDEX{3};    //the part of pipeline::middle that says which snapshot it is
+const unsigned int FRAME_FRESH{4};    //set in pipeline::middle when the simulation has put a snapshot there that the renderer hasn't taken yet
+const unsigned char OUTPUT_TTY{0};  //where frames go, see outputsink. The terminal the game was started in
+const unsigned char OUTPUT_NULL{1}; //nowhere, for timing everything but the terminal
+const unsigned char OUTPUT_FILE{2}; //a file that can be cat'ed to a terminal of the same size to watch the game again
+const size_t CAST_RING_BYTES{1 << 22};   //frames a --cast recording can have waiting for the disk, a power of 2 so positions are masked. Tens of seconds of a busy game
+const size_t CAST_WRITE_BYTES{1 << 16};  //the cast writer thread writes whenever this much is formatted, so it never holds more than this however big a frame is
+const chrono::milliseconds CAST_FLUSH_INTERVAL{100}; //how long the cast writer thread sleeps between batches
+const size_t SPECTATE_RING_BYTES{1 << 22}; //frames a --broadcast game keeps for spectators, a power of 2 so positions are masked. Many keyframes' worth
+const chrono::milliseconds SPECTATE_KEYFRAME_INTERVAL{1000}; //how often the whole screen goes into the ring, so a spectator that just attached or fell behind can start again from it
+const char SPECTATE_MAGIC[8]{'D', 'I', 'N', 'O', 'S', 'P', 'E', 'C'};
+const chrono::nanoseconds RENDER_INTERVAL{16666667}; //60 fps, the fastest the renderer draws. It slows down to keep its average frame under half of the time between frames
+
+const unsigned char NET_WELCOME{1};  //kinds of message. Server to client, the racer slot the client has is in netmessage::frame
+const unsigned char NET_SNAPSHOT{2}; //server to client, the 1 byte kind, a 4 byte frame, the 4 byte frame it is a delta against (0 for none) and then the delta, see encodeDelta
+const unsigned char NET_INPUT{3};    //client to server, a jump in netmessage::key
+const unsigned char NET_ACK{4};      //client to server, the newest snapshot the client has in netmessage::frame
+const uint32_t NET_HISTORY{32};      //snapshots the server and each client keep to make deltas from. A client more than this far behind gets a whole snapshot instead
+const size_t NET_MAX_PLAYERS{64};
+const size_t NET_MESSAGE_BYTES{1 << 16}; //the biggest snapshot that is sent, which is a few thousand clouds
+const unsigned int RACE_PAUSE{30};       //ticks between the end of a race and the start of the next, so everyone gets to see how it went
+const size_t RACE_FIELDS{7};     //a packed race starts with the race, ticks, rows, cols and how many racers, obstacles and clouds there are
+const size_t RACER_FIELDS{5};    //then each racer's state, row, col, t and score
+const size_t OBSTACLE_FIELDS{3}; //then each obstacle's row, col and velocity
+const size_t CLOUD_FIELDS{2};    //then each cloud's row and col
+
+const size_t PROFILE_SPANS{1 << 16}; //how many of the latest spans --profile keeps, a power of 2 so the ring index is a mask. About 6000 ticks of the terminal game
+
 struct termios initialTerm;
-default_random_engine generator;
-uniform_int_distribution<unsigned int> cloudvelocity(1, 5);
-uniform_int_distribution<unsigned int> obvelocity(2, 6);
-
-int screenWidth;
-int screenLength;
-int t {0};
-unsigned int score{0};
+atomic<unsigned int> terminalResizes{0}; //counts SIGWINCH, each thread that cares keeps the count it last acted on
+const uniform_int_distribution<unsigned int> cloudvelocity(1, 5);
+const uniform_int_distribution<unsigned int> obvelocity(2, OBSTACLE_FASTEST);
 #pragma clang diagnostic pop
 
-uniform_int_distribution<int> obspawns(100, screenLength); //We couldnt end up using any of these distributions as they broke, see more info under struct cloud documentation
-uniform_int_distribution<int> cloudrows(0, (screenWidth / 2) + 15);
-uniform_int_distribution<int> cloudcols(0, screenLength);
+//Counts every call to the global operator new, so we can check that a running game doesn't allocate. It is one relaxed atomic add, cheap enough to always leave on
+atomic<unsigned long long> heapAllocations{0};
+
+//A program using the library has its own allocator, so the counting one is only in the game
+#ifndef DINOSAUR_LIBRARY
+auto operator new(size_t size) -> void *
+{
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+    if (void *memory = malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw bad_alloc{};
+}
+auto operator delete(void *memory) noexcept -> void { free(memory); }
+auto operator delete(void *memory, size_t) noexcept -> void { free(memory); }
+#endif
+
+//Replaces experimental::randint, which used its own hidden engine. Distributions that depend on the screen size are built when they are used,
+//a distribution built up here would be built before the screen size is known (which is why the ones we had here used to break)
+auto randomBetween(default_random_engine &generator, int low, int high) -> int
+{
+    return uniform_int_distribution<int>(low, high)(generator);
+}
+
+//Draws from one of the distributions above. It works on a copy, so games running on different threads never share any state
+auto randomFrom(uniform_int_distribution<unsigned int> distribution, default_random_engine &generator) -> int
+{
+    return static_cast<int>(distribution(generator));
+}
 
-//uniform_int_distribution<int> cloudcols(0, screenLength);
-//uniform_int_distribution<int> cloudrows(0, screenWidth / 2 + 15);
+//Game number index of a batch, or chunk number index of an endless level, gets its own seed. Mixed with splitmix64 because seeds one apart would otherwise start with related numbers
+auto batchSeed(uint64_t seed, uint64_t index) -> uint64_t
+{
+    uint64_t mixed{seed + (index + 1) * 0x9e3779b97f4a7c15ull};
+    mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ull;
+    mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebull;
+    return mixed ^ (mixed >> 31);
+}
 
 // Types
 
@@ -100,22 +270,780 @@ struct player
     position position{};
 };
 
-struct cloud
+//Every cloud, stored as parallel arrays instead of a struct per cloud. Moving them only streams through the arrays that change, and the loops over them
+//have no branches in them so the compiler can vectorise them. The arrays are sized once in setupWorld and the live clouds are always the first count entries
+struct cloudfield
+{
+    vector<int> row{};
+    vector<int> col{};
+    vector<int> velocity{};        //Determines how fast the clouds move. They will move anywhere from 1 to 5 units per tick depending on a uniform distribution
+    vector<unsigned char> alive{}; //cleared once the cloud has completely left the screen, and the cloud is removed at the end of that tick
+    size_t count{0};
+};
+
+//Same as cloudfield but for the obstacles, which are kept sorted by column (see sortObstacles)
+struct obstaclefield
+{
+    vector<int> row{};
+    vector<int> col{};
+    vector<int> velocity{};
+    size_t count{0};
+};
+
+//Scratch memory for data that only lives for one tick. Allocating is just moving an offset forward, and the whole arena is emptied at the start of each tick
+struct framearena
+{
+    vector<byte> memory{};
+    size_t used{0};
+};
+
+//Something a chunk brings in at the right edge. Clouds keep their height as thousandths of the sky, so a chunk made before a resize still fits after it
+struct chunkspawn
+{
+    uint8_t tick{0}; //ticks into the chunk
+    uint8_t kind{SPAWN_OBSTACLE};
+    uint8_t velocity{0};
+    uint16_t height{0};
+};
+
+//A stretch of an endless level. Fixed size, so a chunk can be made into a slot or copied into a world without allocating, and the spawns are sorted by tick
+struct levelchunk
+{
+    uint64_t index{0};
+    size_t count{0};
+    chunkspawn spawns[CHUNK_SPAWNS]{};
+};
+
+//Chunks made ahead of time by the level worker thread, so moving on to a new chunk doesn't have to make one. Chunk n is made into slots[n % CHUNK_SLOTS] once the tick thread
+//has taken chunk n - CHUNK_SLOTS, so the ring (and the memory) stays the same size however long the game goes on
+struct levelstream
+{
+    levelchunk slots[CHUNK_SLOTS]{};
+    uint64_t seed{0};
+    alignas(64) atomic<uint64_t> made{0};  //every chunk before this that hasn't been taken yet is in its slot, moved by the worker
+    alignas(64) atomic<uint64_t> taken{0}; //the next chunk the tick thread wants, moved by the tick thread
+    atomic<bool> running{true};
+    thread worker{};
+};
+
+//One thing in a level file. Obstacles only need their column, scenery keeps its height as thousandths of the sky like a chunkspawn does
+struct levelentity
+{
+    int32_t col{0};
+    int32_t height{0};
+};
+
+//Where one kind of entity is in a level file: count of them sorted by column starting offset bytes in, and the sparse index of the column of every LEVEL_INDEX_STRIDE'th one
+struct levelsection
+{
+    uint64_t offset{0};
+    uint64_t count{0};
+    uint64_t indexOffset{0};
+    uint64_t indexCount{0};
+};
+
+//Start of a level file. Everything is in the machine's byte order, like a trace
+struct levelheader
+{
+    char magic[8]{};
+    int64_t length{0}; //the level is won once the player is this many columns into it
+    levelsection obstacles{};
+    levelsection scenery{};
+};
+
+//A level ready to be played. The spans point straight into the file mapped by openLevel, so a page of it is only read once the camera gets there
+struct levelfile
+{
+    int64_t length{0};
+    span<const levelentity> obstacles{};
+    span<const int32_t> obstacleIndex{};
+    span<const levelentity> scenery{};
+    span<const int32_t> sceneryIndex{};
+};
+
+//A racer in a --serve race and the client playing it. The game part is put into the shared world for the racer's turn of each tick, see stepRace
+struct racer
+{
+    int fd{-1};
+    unsigned short state{RACER_EMPTY};
+    player playercharacter{};
+    int t{0};
+    unsigned int score{0};
+    bool jumpWaiting{false}; //a jump that hasn't been used yet, kept for JUMP_BUFFER like the terminal game does
+    chrono::steady_clock::time_point jumpPressed{};
+    uint32_t acked{0};       //the newest snapshot the client has, 0 for none yet
+};
+
+//What a client sends the server. Everything is in the machine's byte order, the socket never leaves the machine
+struct netmessage
+{
+    uint8_t kind{NET_INPUT};
+    char key{NULL_CHAR};
+    uint32_t frame{0};
+};
+
+//Everything that changes while a game is played, so the same update code can drive the terminal game and the headless simulation
+struct world
+{
+    player playercharacter{};
+    cloudfield clouds{}; //stores all of the clouds that will be generated and destroyed
+    framearena scratch{};
+    ground ground{};
+    obstaclefield obstacles{};
+    position scoreposition{};
+    unsigned int ticks{0};
+    int screenWidth{30};  //the number of rows the game is played on. Everything about a game lives in here, so any number of them can run at once
+    int screenLength{100};
+    int t{0};             //how far through a jump the player is, see jumpPlayer
+    unsigned int score{0};
+    default_random_engine generator{}; //every random number in the game comes from here, so a game can be played again exactly from its seed
+    bool endless{false};       //no winning, the obstacles and clouds come from the chunks of a level that never ends, and the camera follows the player
+    uint64_t levelSeed{0};     //what the chunks are made from, drawn from the generator by setupWorld
+    levelchunk chunk{};        //the chunk being played
+    unsigned int chunkTick{0}; //how far into it
+    size_t chunkNext{0};       //its next spawn
+    int cameraShift{0};        //how far the camera moved right in the last tick, so the renderer can slide things back by that too
+    levelstream *levels{nullptr}; //where chunks made ahead come from. Without one, each chunk is made when it is needed
+    const levelfile *level{nullptr}; //a level from a file instead of recycled obstacles. What the camera can see of it is put into obstacles and clouds every tick, see viewLevel
+    int64_t camera{0};               //how many columns into the level the left edge of the screen is
+};
+
+//What a batch worker found over the games it played. Each worker has its own, and they are added up once every worker is done
+struct batchstats
+{
+    unsigned long long won{0};
+    unsigned long long lost{0};
+    unsigned long long outOfTime{0};
+    unsigned long long ticks{0};
+    unsigned long long steals{0};
+    unsigned long long scores[BATCH_SCORE_BUCKETS]{};
+    unsigned long long deaths[BATCH_TIME_BUCKETS]{};
+};
+
+//What --autopilot works out every tick. For each tick ahead and each t, blocked has bit n set when having spent n of those ticks in the air (so being 2n columns
+//further on) gets the player hit. Fixed size, so planning never allocates
+struct autopilot
+{
+    uint64_t blocked[AUTOPILOT_HORIZON + 1][JUMP_PHASES]{};
+    uint64_t winning{0}; //the air counts that get the player to the edge of the screen, which wins before anything else can hit it
+};
+
+//The game numbers a batch worker still has to play, begin in the top 32 bits and end in the bottom 32. Packed into one word, the owner taking from the front
+//and other workers stealing from the back are each a single compare and swap. Each one gets its own cache line so workers don't slow each other down
+struct alignas(64) batchrange
+{
+    atomic<uint64_t> bounds{0};
+};
+
+//A batch of games for training, see DinosaurEnv.h. Each thread steps its own slice of the games, so the only things shared are the buffers of the call being
+//stepped (each thread writes its own part of them) and the two counters. A call bumps generation to wake the workers, and waits for busy to come back to 0
+struct dinosaurenv
+{
+    vector<world> games{};
+    vector<uint64_t> episodes{}; //how many times each game has started again, which picks its next seed
+    uint64_t seed{0};
+    unsigned int obstacles{0};
+    bool resetting{false};           //the call being stepped, or started again if this is set
+    const uint8_t *actions{nullptr};
+    float *observations{nullptr};
+    float *rewards{nullptr};
+    uint8_t *dones{nullptr};
+    vector<thread> workers{};
+    alignas(64) atomic<uint64_t> generation{0};
+    alignas(64) atomic<unsigned int> busy{0};
+    atomic<bool> running{true};
+};
+
+//A key read by the input thread, already decoded from the bytes the terminal sent. The time is when the read that brought it in returned
+struct inputevent
+{
+    unsigned char kind{KEY_TEXT};
+    char key{NULL_CHAR};
+    chrono::steady_clock::time_point time{};
+};
+
+//Queue of keys from the input thread to the simulation thread. Only one thread ever writes and one reads, so each side owns one index and just publishes it
+struct inputqueue
+{
+    inputevent events[INPUT_QUEUE_SLOTS]{};
+    alignas(64) atomic<size_t> head{0}; //next to read, moved by the simulation thread
+    alignas(64) atomic<size_t> tail{0}; //next to write, moved by the input thread
+};
+
+//Where the input thread is in an escape sequence. A sequence can be split across two reads, so this lives as long as the thread does
+struct keydecoder
+{
+    unsigned char state{DECODE_TEXT};
+};
+
+//A finished tick as the renderer sees it. The simulation thread copies the world into one of these and never touches it again until the renderer has moved on
+struct snapshot
+{
+    world game{};
+    position playerBefore{}; //where the player was before this tick, for drawing the frames in between
+    chrono::steady_clock::time_point time{}; //when the tick ran
+    unsigned short state{GAME_RUNNING};
+};
+
+//What the three threads of the terminal game share. The snapshots are a triple buffer: the simulation thread owns one to write into, the renderer owns one to draw from,
+//and the third is in the middle. Each side swaps its own for the middle one, so the simulation never waits for the renderer and the renderer always gets the newest tick
+struct pipeline
+{
+    inputqueue input{};
+    snapshot frames[3]{};
+    atomic<unsigned int> middle{1};
+    atomic<bool> running{true};
+    int wake{-1}; //eventfd that tells the input thread to stop waiting on stdin
+};
+
+//Options picked on the command line
+struct settings
+{
+    bool headless{false};
+    bool bench{false};
+    bool autopilot{false};              //the game plays itself, see autopilotInput
+    int rows{30};                       //only used by the headless simulation, the terminal game measures the terminal
+    int cols{100};
+    unsigned long long maxTicks{1000000};
+    unsigned long long batchGames{0};   //how many games --batch plays
+    unsigned int threads{0};            //workers for --batch, 0 is one per core
+    string script{};                    //input for the headless simulation, one character per tick, repeated when it runs out
+    uint64_t seed{random_device{}()};
+    unsigned int obstacles{3};
+    bool endless{false};
+    unsigned int clouds{0};             //extra clouds made at the start on top of the usual 3 to 8, to load up the simulation
+    string recordPath{};                //where to write the trace of the game being played
+    string replayPath{};                //a trace to play back as fast as possible instead of playing
+    string profilePath{};               //where to write the Chrome trace of how long each stage of each tick took
+    string outputPath{};                //where the terminal game sends its frames, empty for the terminal, "null" for nowhere, anything else is a file
+    string castPath{};                  //where to record the terminal game as an asciicast, to watch again with asciinema
+    string levelPath{};                 //a level file to play instead of the usual game
+    const levelfile *level{nullptr};    //levelPath once main has opened it
+    string makeLevelPath{};             //where --make-level writes the level it makes
+    string servePath{};                 //the socket --serve runs a race on
+    string joinPath{};                  //the socket of the race --join plays in
+    string broadcastName{};             //the name spectators can watch the terminal game by
+    string spectateName{};              //the name of the game --spectate watches
+    int64_t levelLength{1000000};       //how many columns long that level is
+    unsigned char logLevel{LOG_DEBUG};
+};
+
+//Start of a trace file, followed by records of a 4 byte tick, a 1 byte TRACE_ kind and its value. Everything is in the machine's byte order
+struct traceheader
+{
+    char magic[8]{};
+    uint64_t seed{0};
+    int32_t rows{0};
+    int32_t cols{0};
+    int32_t obstacles{0};
+    int32_t clouds{0};
+    int32_t endless{0};
+    int64_t levelLength{0}; //the length of the level the game was played on, 0 for no level
+};
+
+//The trace being recorded. Nothing is written when the file isn't open, which is the case unless --record was given
+struct tracewriter
+{
+    ofstream file{};
+};
+
+//A log line before it is formatted. Only the writer thread turns these into text, all the game thread does is copy one of these into the queue
+struct logrecord
+{
+    unsigned char level{LOG_DEBUG};
+    unsigned char kind{LOG_TEXT};
+    char text[38]{};            //the one string a record can carry, cut short if it doesn't fit
+    const char *message{""};    //always a string literal
+    int64_t time{0};            //nanoseconds on the steady clock
+    uint64_t values[5]{};       //what these mean depends on kind
+};
+
+//A slot of the log queue. The sequence number says whether the slot is free to write (equal to the position writing it) or holds a record to read (one more than that)
+struct logslot
+{
+    atomic<size_t> sequence{0};
+    logrecord record{};
+};
+
+//Bounded lock-free queue that any thread can log into, drained by one writer thread. When it is full new records are dropped and counted, logging never waits
+struct logqueue
+{
+    vector<logslot> slots{};
+    alignas(64) atomic<size_t> tail{0}; //next position to write, shared by everything that logs
+    alignas(64) size_t head{0};         //next position to read, only touched by the writer thread
+    atomic<uint64_t> dropped{0};
+    atomic<bool> running{false};
+    unsigned char minimumLevel{LOG_DEBUG};
+    string lines{}; //the writer thread's batch of formatted lines
+    thread writer{};
+};
+
+#ifndef DINOSAUR_NO_PROFILING
+//One timed stage of a tick. The name is always a string literal, so the pointer stays valid until the profile is written
+struct profilespan
+{
+    const char *name{nullptr};
+    int64_t start{0}; //nanoseconds on the steady clock
+    int64_t duration{0};
+    unsigned int thread{0};
+};
+
+//The spans recorded so far. The ring is only allocated when --profile turns profiling on, and after that recording a span is one atomic add and a copy, so it is cheap enough to leave on.
+//Once it is full the oldest spans are overwritten, so the profile always ends with the ticks just before exit
+struct profiler
+{
+    vector<profilespan> spans{};
+    atomic<uint64_t> recorded{0};
+    bool enabled{false};
+    string path{};
+};
+#endif
+
+//One character cell of the screen. The glyph is stored decoded so that multi byte characters like the ground's "‾" still take up exactly one cell
+struct cell
+{
+    char32_t glyph{U' '};
+    unsigned int colour{COLOUR_IGNORE};
+    bool bold{false};
+
+    auto operator==(const cell &other) const -> bool = default;
+};
+
+//Turns cursor moves, attributes and glyphs into the bytes the terminal understands. The bytes are reused every frame so encoding doesn't allocate once they have grown to the
+//size of a frame. The colour and bold are what the terminal has right now, which carries over from one frame to the next, so attributes are only sent when they change
+struct ansiencoder
+{
+    string bytes{};
+    unsigned int colour{COLOUR_IGNORE};
+    bool bold{false};
+};
+
+//The draw functions write into the back grid, and presentFramebuffer compares it against the front grid (what the terminal is showing right now) so only the cells that changed get sent
+struct framebuffer
+{
+    int rows{0};
+    int cols{0};
+    vector<cell> front{};
+    vector<cell> back{};
+    ansiencoder encoder{};
+};
+
+//What goes before each event in the cast ring
+struct castentry
+{
+    int64_t time{0}; //nanoseconds since the recording started
+    uint32_t length{0};
+    char kind{'o'};  //the asciicast event type, 'o' for output or 'r' for a resize
+};
+
+//Frames on their way to a --cast recording. The renderer copies each one into the ring and carries on, and a writer thread turns them into asciicast lines and writes them out,
+//so however slow the disk is only that thread ever waits for it. The ring never grows: a frame that doesn't fit is dropped and counted
+struct castrecorder
 {
-    position position{experimental::randint(0, screenWidth / 2 + screenWidth / 10), experimental::randint(0, screenLength)}; //This code makes sure the clouds spawn outside of the play area
-    //position position{cloudrows(generator), cloudcols(generator)}; //!!! When this "proper" code is used, the game compiles but instantly seg faults when ran. I believe this code doesn't like when screenWidth and screenLength are used, as it also breaks the game when used for the initial positions of the obstacles aswell
-    unsigned int velocity{cloudvelocity(generator)}; //Determines how fast the clouds move. They will move anywhere from 1 to 5 units per tick depending on a uniform distribution
-    unsigned int destructSequence{0}; //This variable is used to destroy visible parts of the cloud in iterations once it reaches the end of the screen, until the cloud is completely invisible
+    vector<char> ring{};
+    alignas(64) atomic<uint64_t> head{0}; //next byte to read, moved by the writer thread
+    alignas(64) atomic<uint64_t> tail{0}; //next byte to write, moved by the renderer
+    atomic<uint64_t> dropped{0};
+    atomic<bool> running{false};
+    int fd{-1};
+    chrono::steady_clock::time_point start{};
+    string lines{}; //the writer thread's formatted lines, never more than CAST_WRITE_BYTES and one escaped byte
+    thread writer{};
 };
 
-struct obstacle
+//What goes before each frame in a spectator ring. Entries start on 8 byte boundaries
+struct spectateentry
 {
-    position position{1, 1};
-    unsigned int velocity{obvelocity(generator)};
+    uint64_t sequence{0}; //counts every frame put in the ring, so a spectator can tell it got the one after the last
+    uint32_t length{0};
+    uint32_t keyframe{0}; //1 when the frame draws the whole screen from blank
 };
 
-typedef vector<cloud> cloudvector;
-typedef vector<obstacle> obvector;
+//The start of the shared memory a --broadcast game puts its frames in, followed by SPECTATE_RING_BYTES of them. Only the game writes to it and it never waits for anyone:
+//a spectator keeps its own place, and checks after copying a frame that the game hadn't started writing over it yet. That check is all a spectator costs the game, which is nothing
+struct spectateheader
+{
+    char magic[8]{};
+    uint64_t capacity{0};
+    alignas(64) atomic<uint64_t> claimed{0}; //the game may be part way through writing anything before this, moved before a frame is copied in
+    atomic<uint64_t> published{0};           //everything before this is whole frames, moved once a frame is in
+    atomic<uint64_t> keyframe{0};            //where the newest keyframe starts
+    atomic<bool> finished{false};            //the game is over and nothing more is coming
+};
+static_assert(atomic<uint64_t>::is_always_lock_free and atomic<bool>::is_always_lock_free, "the spectator ring is shared between processes, so its atomics can't be locks");
+
+//The game's end of a --broadcast ring
+struct broadcaster
+{
+    spectateheader *header{nullptr};
+    span<char> ring{};
+    string name{};
+    uint64_t sequence{0};
+    framebuffer keyframe{}; //the screen presented again from blank for a keyframe, see broadcastKeyframe
+    chrono::steady_clock::time_point lastKeyframe{};
+    unsigned long long keyframes{0};
+};
+
+//Where finished frames are written. Every frame is one write(2), or none at all for OUTPUT_NULL, and these count what went out so that can be checked
+struct outputsink
+{
+    unsigned char kind{OUTPUT_TTY};
+    int fd{-1};
+    unsigned long long frames{0};
+    unsigned long long writes{0};
+    unsigned long long bytes{0};
+    castrecorder *cast{nullptr}; //also gets every frame when the game is being recorded
+    broadcaster *broadcast{nullptr}; //and when spectators can watch it
+    bool needsKeyframe{false};   //the recording dropped a frame, so the next one has to be the whole screen
+};
+
+//A picture stored as rows of decoded glyphs so the blitter can clip it with plain index arithmetic. Spaces are see-through, the same way an empty cell would be
+struct sprite
+{
+    span<const u32string_view> rows{};
+    int width{0};
+    unsigned int colour{COLOUR_IGNORE};
+    bool bold{false};
+    span<const uint64_t> masks{}; //one per row, only for the sprites that can collide, see rowMasks
+};
+
+constexpr auto widestRow(span<const u32string_view> rows) -> int
+{
+    size_t widest{0};
+    for (u32string_view row : rows)
+    {
+        widest = max(widest, row.size());
+    }
+    return static_cast<int>(widest);
+}
+
+//Which cells of each row of a sprite are solid, bit n for column n. Spaces are empty, the same as when it is drawn. Worked out at compile time,
+//so colliding two sprites is just shifting and ANDing these. Only sprites up to 64 columns wide fit
+template <size_t ROWS>
+constexpr auto rowMasks(const u32string_view (&rows)[ROWS]) -> array<uint64_t, ROWS>
+{
+    array<uint64_t, ROWS> masks{};
+    for (size_t row = 0; row < ROWS; row += 1)
+    {
+        for (size_t col = 0; col < rows[row].size(); col += 1)
+        {
+            if (rows[row][col] != U' ')
+            {
+                masks[row] |= uint64_t{1} << col;
+            }
+        }
+    }
+    return masks;
+}
+
+//The same masks smeared to the right by every distance up to STEPS, which covers every column a sprite passed over while moving left that far in one tick
+template <size_t STEPS, size_t ROWS>
+constexpr auto sweptMasks(const array<uint64_t, ROWS> &masks) -> array<array<uint64_t, ROWS>, STEPS + 1>
+{
+    array<array<uint64_t, ROWS>, STEPS + 1> swept{};
+    swept[0] = masks;
+    for (size_t step = 1; step <= STEPS; step += 1)
+    {
+        for (size_t row = 0; row < ROWS; row += 1)
+        {
+            swept[step][row] = swept[step - 1][row] | (swept[step - 1][row] << 1);
+        }
+    }
+    return swept;
+}
+
+// Sprites
+
+constexpr u32string_view CLOUD_ROWS[]{
+    U"_(  )_( )_",
+    U"(_   _    _)",
+    U" (_) (__)"};
+constexpr u32string_view CACTUS_ROWS[]{
+    U"| | ",
+    U"|_| ",
+    U" |  "};
+constexpr u32string_view PLAYER_ROWS[]{
+    U"Σ(⊃≧ᴗ≦)⊃"}; //cute
+constexpr u32string_view GAME_OVER_ROWS[]{
+    U"┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼",
+    U"███▀▀▀██┼███▀▀▀███┼███▀█▄█▀███┼██▀▀▀",
+    U"██┼┼┼┼██┼██┼┼┼┼┼██┼██┼┼┼█┼┼┼██┼██┼┼┼",
+    U"██┼┼┼▄▄▄┼██▄▄▄▄▄██┼██┼┼┼▀┼┼┼██┼██▀▀▀",
+    U"██┼┼┼┼██┼██┼┼┼┼┼██┼██┼┼┼┼┼┼┼██┼██┼┼┼",
+    U"███▄▄▄██┼██┼┼┼┼┼██┼██┼┼┼┼┼┼┼██┼██▄▄▄",
+    U"┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼",
+    U"███▀▀▀███┼▀███┼┼██▀┼██▀▀▀┼██▀▀▀▀██▄┼",
+    U"██┼┼┼┼┼██┼┼┼██┼┼██┼┼██┼┼┼┼██┼┼┼┼┼██┼",
+    U"██┼┼┼┼┼██┼┼┼██┼┼██┼┼██▀▀▀┼██▄▄▄▄▄▀▀┼",
+    U"██┼┼┼┼┼██┼┼┼██┼┼█▀┼┼██┼┼┼┼██┼┼┼┼┼██┼",
+    U"███▄▄▄███┼┼┼─▀█▀┼┼─┼██▄▄▄┼██┼┼┼┼┼██▄",
+    U"┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼██┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼██┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼████▄┼┼┼▄▄▄▄▄▄▄┼┼┼▄████┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼┼▀▀█▄█████████▄█▀▀┼┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼┼┼┼█████████████┼┼┼┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼┼┼┼██▀▀▀███▀▀▀██┼┼┼┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼┼┼┼██┼┼┼███┼┼┼██┼┼┼┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼┼┼┼█████▀▄▀█████┼┼┼┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼┼┼┼┼███████████┼┼┼┼┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼▄▄▄██┼┼█▀█▀█┼┼██▄▄▄┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼▀▀██┼┼┼┼┼┼┼┼┼┼┼██▀▀┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼┼┼▀▀┼┼┼┼┼┼┼┼┼┼┼▀▀┼┼┼┼┼┼┼┼┼┼┼",
+    U"┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼"};
+constexpr u32string_view GAME_WON_ROWS[]{
+    U"                                ,.        ,.      ,.                        ",
+    U"                                ||        ||      ||  ()                    ",
+    U" ,--. ,-. ,.,-.  ,--.,.,-. ,-.  ||-.,.  ,.|| ,-.  ||-.,. ,-. ,.,-.  ,--.    ",
+    U"//`-'//-\\||/|| //-||||/`'//-\\ ||-'||  ||||//-\\ ||-'||//-\\||/|| ((`-'    ",
+    U"||   || |||| ||||  ||||   || || ||  || /|||||| || ||  |||| |||| ||  ``.     ",
+    U"\\,-.\\-//|| || \\-||||   \\-|| ||  ||//||||\\-|| ||  ||\\-//|| || ,-.))    ",
+    U" `--' `-' `' `'  `-,|`'    `-^-``'  `-' `'`' `-^-``'  `' `-' `' `' `--'     ",
+    U"                  //           .--------.                                   ",
+    U"              ,-.//          .: : :  :___`.                                 ",
+    U"              `--'         .'!!:::::  \\_| `.                               ",
+    U"                      : . /%O!!::::::::\\_|. |                              ",
+    U"                     [""]/%%O!!:::::::::  : . |                             ",
+    U"                     |  |%%OO!!::::::::::: : . |                            ",
+    U"                     |  |%%OO!!:::::::::::::  :|                            ",
+    U"                     |  |%%OO!!!::::::::::::: :|                            ",
+    U"            :       .'--`.%%OO!!!:::::::::::: :|                            ",
+    U"          : .:     /`.__.'|%%OO!!!::::::::::::/                             ",
+    U"         :    .   /        |%OO!!!!::::::::::/                              ",
+    U"        ,-'``'-. ;          ;%%OO!!!!!!:::::'                               ",
+    U"        |`-..-'| |   ,--.   |`%%%OO!!!!!!:'                                 ",
+    U"        | .   :| |_.','`.`._|  `%%%OO!%%'                                   ",
+    U"        | . :  | |--'    `--|    `%%%%'                                     ",
+    U"        |`-..-'| ||   | | | |     /__|`-.                                   ",
+    U"        |::::::/ ||)|/|)|)|||           /                                   ",
+    U"---------`::::'--|._ ~**~ _.|----------( -----------------------            ",
+    U"           )(    |  `-..-'  |           |    ______                         ",
+    U"           )(    |          |,--.       ____/ /  /\\ ,-._.-'                ",
+    U"        ,-')('-. |          ||`;/   .-()___  :  |`.!,-'`'/`-._              ",
+    U"       (  '  `  )`-._    _.-'|;,|    `-,    |_|__|`,-'>-.,-._               ",
+    U"        `-....-'     ````    `--'      `-._       (`- `-._`-.               "};
+
+constexpr sprite CLOUD_SPRITE{CLOUD_ROWS, widestRow(CLOUD_ROWS)};
+static_assert(widestRow(CACTUS_ROWS) <= 64 and widestRow(PLAYER_ROWS) <= 64, "sprites that collide have to fit in a 64 bit mask");
+constexpr array<uint64_t, size(CACTUS_ROWS)> CACTUS_MASKS{rowMasks(CACTUS_ROWS)};
+constexpr array<uint64_t, size(PLAYER_ROWS)> PLAYER_MASKS{rowMasks(PLAYER_ROWS)};
+constexpr auto CACTUS_SWEPT_MASKS{sweptMasks<OBSTACLE_FASTEST>(CACTUS_MASKS)}; //indexed by how far the cactus moved
+constexpr sprite CACTUS_SPRITE{CACTUS_ROWS, widestRow(CACTUS_ROWS), COLOUR_GREEN, true, CACTUS_MASKS};
+constexpr sprite PLAYER_SPRITE{PLAYER_ROWS, widestRow(PLAYER_ROWS), COLOUR_BLUE, true, PLAYER_MASKS};
+//How high above the ground the player is at each t of a jump, the same parabola as jumpPlayer. The autopilot plans jumps with it instead of playing them
+constexpr auto JUMP_ARC{[]
+                        {
+                            array<int, JUMP_PHASES> arc{};
+                            for (int t = 1; t < static_cast<int>(JUMP_PHASES); t += 1)
+                            {
+                                arc[static_cast<size_t>(t)] = -(t - 3) * (t - 3) + 9;
+                            }
+                            return arc;
+                        }()};
+//Which numbers of ticks in the air get the player hit by a cactus, at each t of a jump and for each distance the cactus swept over in its last move. Worked out once at compile
+//time from the sprites, and every cactus stands on the ground, so it is all checkCollision can ever find. Each tick in the air is 2 columns, so for a cactus 2c + parity
+//columns right of where the player started (counting from JUMP_HIT_BIAS to the left of it), [sweep][t][parity] shifted right by 63 - c has bit n set if n ticks in the air is hit
+constexpr auto JUMP_HITS{[]
+                         {
+                             array<array<array<uint64_t, 2>, JUMP_PHASES>, OBSTACLE_FASTEST + 1> hits{};
+                             const int cactusTop{1 - static_cast<int>(CACTUS_MASKS.size())}; //rows counted from the ground row, higher is negative
+                             for (size_t sweep = 0; sweep <= OBSTACLE_FASTEST; sweep += 1)
+                             {
+                                 for (size_t t = 0; t < JUMP_PHASES; t += 1)
+                                 {
+                                     for (int offset = -JUMP_HIT_BIAS; offset < 64 - JUMP_HIT_BIAS; offset += 1)
+                                     {
+                                         uint64_t touching{0};
+                                         for (size_t row = 0; row < PLAYER_MASKS.size(); row += 1)
+                                         {
+                                             const int cactusRow{static_cast<int>(row) - JUMP_ARC[t] - cactusTop};
+                                             if (cactusRow < 0 or cactusRow >= static_cast<int>(CACTUS_MASKS.size()))
+                                             {
+                                                 continue;
+                                             }
+                                             const uint64_t mine{PLAYER_MASKS[row]};
+                                             const uint64_t theirs{CACTUS_SWEPT_MASKS[sweep][static_cast<size_t>(cactusRow)]};
+                                             touching |= offset >= 0 ? mine & (theirs << offset) : (mine << -offset) & theirs;
+                                         }
+                                         const int biased{offset + JUMP_HIT_BIAS};
+                                         hits[sweep][t][static_cast<size_t>(biased & 1)] |= touching != 0 ? uint64_t{1} << (63 - biased / 2) : 0;
+                                     }
+                                 }
+                             }
+                             return hits;
+                         }()};
+constexpr sprite RIVAL_SPRITE{PLAYER_ROWS, widestRow(PLAYER_ROWS), COLOUR_MAGENTA}; //everyone else in a race
+constexpr sprite GAME_OVER_SPRITE{GAME_OVER_ROWS, widestRow(GAME_OVER_ROWS)};
+constexpr sprite GAME_WON_SPRITE{GAME_WON_ROWS, widestRow(GAME_WON_ROWS)};
+
+logqueue logs{};
+
+//Queues a record for the writer thread. Claiming a slot is a compare and swap on the tail, and a full queue just drops the record
+auto pushLog(logrecord record) -> void
+{
+    if (record.level < logs.minimumLevel or logs.slots.empty())
+    {
+        return;
+    }
+    record.time = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    size_t position{logs.tail.load(memory_order_relaxed)};
+    while (true)
+    {
+        logslot &slot{logs.slots[position & (LOG_SLOTS - 1)]};
+        const size_t sequence{slot.sequence.load(memory_order_acquire)};
+        if (sequence == position)
+        {
+            if (logs.tail.compare_exchange_weak(position, position + 1, memory_order_relaxed))
+            {
+                slot.record = record;
+                slot.sequence.store(position + 1, memory_order_release);
+                return;
+            }
+        }
+        else if (sequence < position)
+        {
+            logs.dropped.fetch_add(1, memory_order_relaxed); //the writer hasn't caught up with this slot yet, so the queue is full
+            return;
+        }
+        else
+        {
+            position = logs.tail.load(memory_order_relaxed);
+        }
+    }
+}
+
+auto logText(unsigned char level, const char *message, string_view text) -> void
+{
+    logrecord record{.level = level, .kind = LOG_TEXT, .message = message};
+    text.copy(record.text, sizeof(record.text) - 1);
+    pushLog(record);
+}
+
+auto logNumber(unsigned char level, const char *message, uint64_t value) -> void
+{
+    pushLog({.level = level, .kind = LOG_NUMBER, .message = message, .values = {value}});
+}
+
+//The line the terminal game logs every tick, kept as numbers until the writer thread gets to it
+auto logTick(unsigned int ticks, bool allowBackgroundProcessing, long long elapsed, char currentChar, string_view currentCommand, uint64_t allocations) -> void
+{
+    logrecord record{.level = LOG_DEBUG, .kind = LOG_TICK, .values = {ticks, allowBackgroundProcessing, static_cast<uint64_t>(elapsed), static_cast<unsigned char>(currentChar), allocations}};
+    currentCommand.copy(record.text, sizeof(record.text) - 1);
+    pushLog(record);
+}
+
+//Formats one record onto the end of lines, in the same shape the old cerr lines had with the time and level in front
+auto formatLog(string &lines, const logrecord &record, int64_t origin) -> void
+{
+    char line[256]{};
+    int length{0};
+    const double seconds{static_cast<double>(record.time - origin) / 1e9};
+    if (record.kind == LOG_TICK)
+    {
+        length = snprintf(line, sizeof(line), "%10.3f %-5s Ticks [%llu] allowBackgroundProcessing [%llu] elapsed [%lld] currentChar [%c] currentCommand [%s] allocations [%llu]\n", seconds,
+                          LOG_LEVEL_NAMES[record.level], static_cast<unsigned long long>(record.values[0]), static_cast<unsigned long long>(record.values[1]),
+                          static_cast<long long>(record.values[2]), static_cast<char>(record.values[3]), record.text, static_cast<unsigned long long>(record.values[4]));
+    }
+    else if (record.kind == LOG_NUMBER)
+    {
+        length = snprintf(line, sizeof(line), "%10.3f %-5s %s [%llu]\n", seconds, LOG_LEVEL_NAMES[record.level], record.message, static_cast<unsigned long long>(record.values[0]));
+    }
+    else
+    {
+        length = snprintf(line, sizeof(line), record.text[0] == '\0' ? "%10.3f %-5s %s\n" : "%10.3f %-5s %s [%s]\n", seconds, LOG_LEVEL_NAMES[record.level], record.message, record.text);
+    }
+    lines.append(line, static_cast<size_t>(min(max(length, 0), static_cast<int>(sizeof(line) - 1))));
+}
+
+//The writer thread. Every LOG_FLUSH_INTERVAL it takes everything in the queue, formats it and writes it to stderr in one write, so a slow disk only ever holds up this thread.
+//The rate limit is applied here, by the time on each record, rather than where the records are made
+auto writeLogs() -> void
+{
+    string &lines{logs.lines};
+    const int64_t origin{chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count()};
+    double allowance{LOG_LINES_PER_SECOND};
+    int64_t lastRefill{origin};
+    uint64_t suppressed{0};
+    uint64_t droppedReported{0};
+    bool keepGoing{true};
+    while (keepGoing)
+    {
+        keepGoing = logs.running.load(memory_order_acquire); //read before draining, so the records logged before stopLogging are always written
+        for (size_t batch = 0; batch < LOG_SLOTS; batch += 1)
+        {
+            logslot &slot{logs.slots[logs.head & (LOG_SLOTS - 1)]};
+            if (slot.sequence.load(memory_order_acquire) != logs.head + 1)
+            {
+                break;
+            }
+            const logrecord record{slot.record};
+            slot.sequence.store(logs.head + LOG_SLOTS, memory_order_release);
+            logs.head += 1;
+
+            allowance = min(LOG_LINES_PER_SECOND, allowance + static_cast<double>(record.time - lastRefill) / 1e9 * LOG_LINES_PER_SECOND);
+            lastRefill = max(lastRefill, record.time);
+            if (record.level < LOG_WARN and allowance < 1)
+            {
+                suppressed += 1;
+                continue;
+            }
+            if (record.level < LOG_WARN)
+            {
+                allowance -= 1;
+            }
+            if (suppressed > 0)
+            {
+                formatLog(lines, {.level = LOG_WARN, .kind = LOG_NUMBER, .message = "Log lines over the rate limit", .time = record.time, .values = {suppressed}}, origin);
+                suppressed = 0;
+            }
+            formatLog(lines, record, origin);
+        }
+        const uint64_t dropped{logs.dropped.load(memory_order_relaxed)};
+        if (dropped != droppedReported)
+        {
+            formatLog(lines, {.level = LOG_WARN, .kind = LOG_NUMBER, .message = "Log records dropped with the queue full", .time = lastRefill, .values = {dropped - droppedReported}}, origin);
+            droppedReported = dropped;
+        }
+        for (size_t written = 0; written < lines.size();)
+        {
+            const ssize_t result{write(STDERR_FILENO, lines.data() + written, lines.size() - written)};
+            if (result <= 0)
+            {
+                break; //nowhere to put the log, so it is lost rather than stalling
+            }
+            written += static_cast<size_t>(result);
+        }
+        lines.clear();
+        if (keepGoing)
+        {
+            this_thread::sleep_for(LOG_FLUSH_INTERVAL);
+        }
+    }
+}
+
+//Stops the writer thread once it has written everything queued so far. Registered with atexit by startLogging
+auto stopLogging() -> void
+{
+    logs.running.store(false, memory_order_release);
+    if (logs.writer.joinable())
+    {
+        logs.writer.join();
+    }
+}
+
+//Allocates the queue and starts the writer thread. Records logged before this are thrown away
+auto startLogging(unsigned char minimumLevel) -> void
+{
+    logs.slots = vector<logslot>(LOG_SLOTS);
+    for (size_t slot = 0; slot < LOG_SLOTS; slot += 1)
+    {
+        logs.slots[slot].sequence.store(slot, memory_order_relaxed);
+    }
+    logs.minimumLevel = minimumLevel;
+    logs.lines.reserve((2 * LOG_SLOTS + 1) * 256); //the most one batch can format, so the writer thread doesn't allocate while the game is counting allocations either
+    logs.running.store(true, memory_order_release);
+    logs.writer = thread{writeLogs};
+    atexit(stopLogging);
+}
 
 //------------------------------------------------------------------------------------------------------------------------!MAGIC!-------------------------------------------------------------------------------------------------------------------------
 // These two functions are taken from StackExchange and are
@@ -156,7 +1084,7 @@ auto SetNonblockingReadState(bool desiredState = true) -> void
     {
         fcntl(0, F_SETFL, (currentFlags & (~O_NONBLOCK)));
     }
-    cerr << "SetNonblockingReadState [" << desiredState << "]" << endl;
+    logNumber(LOG_DEBUG, "SetNonblockingReadState", desiredState);
 }
 // Everything from here on is based on ANSI codes
 // Note the use of "flush" after every write to ensure the screen updates
@@ -164,767 +1092,3811 @@ auto ClearScreen() -> void { cout << ANSI_START << "2J" << flush; }
 auto MoveTo(unsigned int x, unsigned int y) -> void { cout << ANSI_START << x << ";" << y << "H" << flush; }
 auto HideCursor() -> void { cout << ANSI_START << "?25l" << flush; }
 auto ShowCursor() -> void { cout << ANSI_START << "?25h" << flush; }
-auto GetTerminalSize() -> position
+auto GetTerminalSize(chrono::milliseconds timeout) -> position
 {
     // This feels sketchy but is actually about the only way to make this work
     MoveTo(999, 999);
     cout << ANSI_START << "6n" << flush;
     string responseString;
-    char currentChar{static_cast<char>(getchar())};
+    const auto deadline{chrono::steady_clock::now() + timeout};
+    char currentChar{EMPTY_CHAR};
     while (currentChar != 'R')
     {
-        responseString += currentChar;
-        currentChar = getchar();
+        // a terminal that never answers would hang here forever, so give up at the deadline and let the caller decide
+        const auto remaining{chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count()};
+        pollfd source{.fd = 0, .events = POLLIN, .revents = 0};
+        if (remaining <= 0)
+        {
+            return {};
+        }
+        if (poll(&source, 1, static_cast<int>(remaining)) <= 0 or read(0, &currentChar, 1) != 1)
+        {
+            continue;
+        }
+        if (currentChar != 'R')
+        {
+            responseString += currentChar;
+        }
     }
-    // format is ESC[nnn;mmm ... so remove the first 2 characters + split on ; + convert to unsigned int
-    // cerr << responseString << endl;
-    responseString.erase(0, 2);
-    // cerr << responseString << endl;
+    // format is ESC[nnn;mmm ... so remove everything up to the [ + split on ; + convert to int
+    responseString.erase(0, responseString.rfind('[') + 1);
     auto semicolonLocation = responseString.find(";");
-    // cerr << "[" << semicolonLocation << "]" << endl;
+    if (semicolonLocation == string::npos)
+    {
+        return {};
+    }
     auto rowsString{responseString.substr(0, semicolonLocation)};
     auto colsString{responseString.substr((semicolonLocation + 1), responseString.size())};
-    // cerr << "[" << rowsString << "][" << colsString << "]" << endl;
-    auto rows = stoul(rowsString);
-    auto cols = stoul(colsString);
-    position returnSize{static_cast<int>(rows), static_cast<int>(cols)};
-    // cerr << "[" << returnSize.row << "," << returnSize.col << "]" << endl;
+    position returnSize{atoi(rowsString.c_str()), atoi(colsString.c_str())};
     return returnSize;
 }
 //------------------------------------------------------------------------------------------------------------------------!MAGIC!-------------------------------------------------------------------------------------------------------------------------
 
-//This function deals with animating the individual cloud entrances and exits, aswell as its normal movement across the screen. An index based for loop was used as the location of the clouds were necessary so we could mark clouds at certain positions that were going to be destroyed 
-auto drawClouds(cloudvector &clouds) -> void
-{
-    vector<unsigned int> markForDeath;
-    for (unsigned int cloud = 0; cloud < clouds.size(); cloud += 1)
-    {
-        // These are clouds being generated at the right side of the screen.
-        if (clouds.at(cloud).position.col == screenLength - 1)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " " << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 2)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (" << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 3)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_( " << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_ " << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_" << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 4)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(  " << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_  " << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_)" << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 5)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(  )" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_   " << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_) " << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 6)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(  )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_   _" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_) (" << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 7)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(  )_(" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_   _ " << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_) (_" << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 8)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(  )_( " << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_   _  " << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_) (__" << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 9)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(  )_( )" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_   _   " << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_) (__" << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 10)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(  )_( )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_   _    " << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_) (__)" << flush;
-        }
-        else if (clouds.at(cloud).position.col == screenLength - 11)
-        {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(  )_( )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_   _    _" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_) (__)" << flush;
-        }
-        // ... And these are clouds being destroyed at the left side of the screen. 
-        
-        else if (clouds.at(cloud).position.col <= 0 and clouds.at(cloud).destructSequence == 0) //once this part of the statement is triggered, the destructsequence cascade begins and the cloud will die over the next 11 ticks
-        {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << "(  )_( )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << "_   _    _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << "(_) (__)" << flush;
-        }
-
-        else if (clouds.at(cloud).destructSequence == 1)
-        {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << "  )_( )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << "   _    _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << "_) (__)" << flush;
-        }
-
-        else if (clouds.at(cloud).destructSequence == 2)
-        {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << " )_( )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << "  _    _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << ") (__)" << flush;
-        }
+//Asks the kernel how big the terminal is. Unlike GetTerminalSize this doesn't need an answer from the terminal, so it is instant and safe to call while another thread is reading stdin.
+//Returns {0, 0} when the size isn't known, like when stdout isn't a terminal or the terminal never told the kernel its size
+auto windowSize() -> position
+{
+    winsize size{};
+    if (ioctl(fileno(stdout), TIOCGWINSZ, &size) < 0 or size.ws_row == 0 or size.ws_col == 0)
+    {
+        return {};
+    }
+    return {size.ws_row, size.ws_col};
+}
 
-        else if (clouds.at(cloud).destructSequence == 3)
-        {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << ")_( )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << " _    _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << " (__)" << flush;
-        }
+//The SIGWINCH handler. It only bumps a counter, the simulation and the renderer each pick the new size up on their next pass
+auto noteResize(int) -> void
+{
+    terminalResizes.fetch_add(1, memory_order_relaxed);
+}
 
-        else if (clouds.at(cloud).destructSequence == 4)
-        {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << "_( )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << "_    _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << "(__)" << flush;
-        }
+auto watchResizes() -> void
+{
+    struct sigaction action{};
+    action.sa_handler = noteResize;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGWINCH, &action, nullptr);
+}
 
-        else if (clouds.at(cloud).destructSequence == 5)
+#ifndef DINOSAUR_NO_PROFILING
+profiler profile{};
+atomic<unsigned int> profileThreads{0};
+thread_local const unsigned int profileThread{profileThreads.fetch_add(1)}; //a small number for each thread, Chrome's tid
+
+auto profileClock() -> int64_t
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//Claims the next slot of the ring with one atomic add, so any thread can record without locking
+auto recordSpan(const char *name, int64_t start, int64_t end) -> void
+{
+    const uint64_t slot{profile.recorded.fetch_add(1, memory_order_relaxed)};
+    profile.spans[slot & (PROFILE_SPANS - 1)] = {.name = name, .start = start, .duration = end - start, .thread = profileThread};
+}
+
+//Times the scope it is declared in. When profiling is off this is just checking the flag twice
+struct scopedspan
+{
+    const char *name;
+    int64_t start;
+    explicit scopedspan(const char *spanName) : name{spanName}, start{profile.enabled ? profileClock() : 0} {}
+    ~scopedspan()
+    {
+        if (profile.enabled)
         {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << "( )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << "    _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << "__)" << flush;
+            recordSpan(name, start, profileClock());
         }
+    }
+    scopedspan(const scopedspan &) = delete;
+    auto operator=(const scopedspan &) -> scopedspan & = delete;
+};
+#define SCOPED_SPAN(name) scopedspan scopedSpan{name}
+
+//Writes every span still in the ring as Chrome trace-event JSON, which Perfetto and chrome://tracing can open. Registered with atexit so every way out of the program writes it
+auto writeProfile() -> void
+{
+    profile.enabled = false;
+    ofstream file{profile.path};
+    if (not file)
+    {
+        cerr << "Error opening profile [" << profile.path << "]" << endl;
+        return;
+    }
+    const uint64_t recorded{profile.recorded.load()};
+    const uint64_t first{recorded > PROFILE_SPANS ? recorded - PROFILE_SPANS : 0};
+    const int64_t origin{recorded > 0 ? profile.spans[first & (PROFILE_SPANS - 1)].start : 0};
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (uint64_t slot = first; slot < recorded; slot += 1)
+    {
+        const profilespan &span{profile.spans[slot & (PROFILE_SPANS - 1)]};
+        char event[160]{};
+        snprintf(event, sizeof(event), "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}", slot == first ? "" : ",", span.name,
+                 static_cast<double>(span.start - origin) / 1000, static_cast<double>(span.duration) / 1000, span.thread);
+        file << event;
+    }
+    file << "\n]}\n";
+    cerr << "Wrote " << recorded - first << " spans to [" << profile.path << "]" << endl;
+}
+
+//Allocates the ring and starts recording. Nothing is recorded unless this is called
+auto startProfiling(const string &path) -> void
+{
+    profile.spans.assign(PROFILE_SPANS, profilespan{});
+    profile.path = path;
+    profile.enabled = true;
+    atexit(writeProfile);
+}
+#else
+#define SCOPED_SPAN(name)
+#endif
+
+//Makes a timer that becomes readable every tickMilliseconds, so the main loop can sleep in poll() between ticks. The period is fixed by the kernel, so ticks don't drift by however long the previous one took
+auto createTickTimer(int tickMilliseconds) -> int
+{
+    int timer{timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)};
+    const timespec period{.tv_sec = tickMilliseconds / 1000, .tv_nsec = (tickMilliseconds % 1000) * 1000000L};
+    const itimerspec schedule{.it_interval = period, .it_value = period};
+    if (timer < 0 or timerfd_settime(timer, 0, &schedule, nullptr) < 0)
+    {
+        logText(LOG_ERROR, "Error creating the tick timer", "");
+    }
+    return timer;
+}
+
+//Sizes both grids to the terminal and assumes the terminal has just been cleared, so the front grid starts out blank
+auto resizeFramebuffer(framebuffer &screen, int rows, int cols) -> void
+{
+    screen.rows = rows;
+    screen.cols = cols;
+    screen.front.assign(static_cast<size_t>(rows * cols), cell{});
+    screen.back.assign(static_cast<size_t>(rows * cols), cell{});
+    screen.encoder.bytes.reserve(static_cast<size_t>(rows * cols) * 16); //every cell with its own cursor move and colour, which is more than a frame ever needs
+}
+
+//Replaces ClearScreen() for each tick. Nothing is sent to the terminal, the back grid is just blanked so the draw functions can start from nothing
+auto clearFramebuffer(framebuffer &screen) -> void
+{
+    SCOPED_SPAN("clearFramebuffer");
+    fill(screen.back.begin(), screen.back.end(), cell{});
+}
 
-        else if (clouds.at(cloud).destructSequence == 6)
+//Positions in the grid use the game's own convention: rows count from 1 like the terminal (so screenWidth is the bottom row), and columns count from 0 since the terminal always drew column 0 and 1 in the same place.
+//Anything outside the screen is clipped instead of wrapping
+
+//Copies a sprite into the back grid with its top left corner at the given position. Only the part of the sprite that is actually on screen is visited, so a cloud that is mostly off the edge costs only the cells that are left
+auto blitSprite(framebuffer &screen, const sprite &picture, position topLeft) -> void
+{
+    const int firstCol{max(0, -topLeft.col)};
+    for (int spriteRow = 0; spriteRow < static_cast<int>(picture.rows.size()); spriteRow += 1)
+    {
+        const int row{topLeft.row + spriteRow};
+        if (row < 1 or row > screen.rows)
         {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << " )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << "   _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << "_)" << flush;
+            continue;
         }
-
-        else if (clouds.at(cloud).destructSequence == 7)
+        const u32string_view glyphs{picture.rows[spriteRow]};
+        const int lastCol{min(static_cast<int>(glyphs.size()), screen.cols - topLeft.col)};
+        cell *line{&screen.back[static_cast<size_t>((row - 1) * screen.cols)]};
+        for (int col = firstCol; col < lastCol; col += 1)
         {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << ")_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << "  _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << ")" << flush;
+            if (glyphs[col] != U' ')
+            {
+                line[topLeft.col + col] = cell{glyphs[col], picture.colour, picture.bold};
+            }
         }
+    }
+}
 
-        else if (clouds.at(cloud).destructSequence == 8)
+//Writes UTF-8 text into the back grid, for text that is only known at runtime like the score
+auto putText(framebuffer &screen, int row, int col, string_view text, unsigned int colour = COLOUR_IGNORE, bool bold = false) -> void
+{
+    if (row < 1 or row > screen.rows)
+    {
+        return;
+    }
+    cell *line{&screen.back[static_cast<size_t>((row - 1) * screen.cols)]};
+    size_t i{0};
+    while (i < text.size() and col < screen.cols)
+    {
+        //decode one UTF-8 sequence, the length comes from the leading byte
+        auto lead{static_cast<unsigned char>(text[i])};
+        char32_t glyph{lead};
+        size_t length{1};
+        if (lead >= 0xF0)
         {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << "_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << " _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << "" << flush;
+            glyph = lead & 0x07;
+            length = 4;
         }
-
-        else if (clouds.at(cloud).destructSequence == 9)
+        else if (lead >= 0xE0)
         {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << "" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << "_)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << "" << flush;
+            glyph = lead & 0x0F;
+            length = 3;
         }
-
-        else if (clouds.at(cloud).destructSequence == 10)
+        else if (lead >= 0xC0)
         {
-            clouds.at(cloud).destructSequence += clouds.at(cloud).velocity;
-            MoveTo(clouds.at(cloud).position.row, 0);
-            cout << "" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, 0);
-            cout << ")" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, 0);
-            cout << "" << flush;
+            glyph = lead & 0x1F;
+            length = 2;
         }
-
-        else
+        for (size_t continuation = 1; continuation < length and i + continuation < text.size(); continuation += 1)
         {
-            MoveTo(clouds.at(cloud).position.row, clouds.at(cloud).position.col);
-            cout << "_(  )_( )_" << flush;
-            MoveTo(clouds.at(cloud).position.row + 1, clouds.at(cloud).position.col);
-            cout << "(_   _    _)" << flush;
-            MoveTo(clouds.at(cloud).position.row + 2, clouds.at(cloud).position.col);
-            cout << " (_) (__)" << flush;
+            glyph = (glyph << 6) | (static_cast<unsigned char>(text[i + continuation]) & 0x3F);
         }
-        if (clouds.at(cloud).destructSequence >= 11)
+        i += length;
+        //a space looks the same in any colour, so storing it plain lets it match the blank cells it usually replaces
+        if (col >= 0)
         {
-            markForDeath.push_back(cloud); //cloud positions are marked but not destroyed yet, as destroying them here causes seg faults. 
+            line[col] = glyph == U' ' ? cell{} : cell{glyph, colour, bold};
         }
+        col += 1;
     }
-    for (unsigned int element : markForDeath)
-        clouds.erase(clouds.begin() + (element)); //according to the documentation, .erase fills in the erased position immediately. It only takes iterators so we had to use clouds.begin()
 }
 
-//This function updates the position of each cloud according to its inherent velocity. An index based approach was beggrudgingly used as the below function would break the clouds for an unknown reason
-auto moveClouds(cloudvector &clouds) -> void
+//Every number from 00 to 99 as two characters, so a number is written two digits at a time without any division by 10
+constexpr array<char, 200> DIGIT_PAIRS{[]
+                                       {
+                                           array<char, 200> pairs{};
+                                           for (int number = 0; number < 100; number += 1)
+                                           {
+                                               pairs[2 * number] = static_cast<char>('0' + number / 10);
+                                               pairs[2 * number + 1] = static_cast<char>('0' + number % 10);
+                                           }
+                                           return pairs;
+                                       }()};
+
+auto encodeNumber(ansiencoder &encoder, unsigned int value) -> void
 {
-    for (unsigned int cloud = 0; cloud < clouds.size(); cloud += 1)
+    char digits[10];
+    char *const end{digits + size(digits)};
+    char *start{end};
+    while (value >= 100)
+    {
+        const unsigned int pair{(value % 100) * 2};
+        value /= 100;
+        start -= 2;
+        start[0] = DIGIT_PAIRS[pair];
+        start[1] = DIGIT_PAIRS[pair + 1];
+    }
+    if (value >= 10)
+    {
+        start -= 2;
+        start[0] = DIGIT_PAIRS[value * 2];
+        start[1] = DIGIT_PAIRS[value * 2 + 1];
+    }
+    else
     {
-        clouds.at(cloud).position.col -= clouds.at(cloud).velocity;
+        start -= 1;
+        start[0] = static_cast<char>('0' + value);
     }
+    encoder.bytes.append(start, end);
 }
 
-//this code broke the clouds even though a range based for loop would be more suitable here
-// auto moveClouds(cloudvector &clouds) -> void
-// {
-//     for (cloud currentCloud: clouds)
-//     {
-//         currentCloud.position.col -= currentCloud.velocity;
-//     }
-// }
+//An escape sequence with no numbers in it, like "2J" to clear the screen
+auto encodeControl(ansiencoder &encoder, string_view code) -> void
+{
+    encoder.bytes += "\033[";
+    encoder.bytes += code;
+}
 
-//same as drawClouds but for the obstacles, there is no "destruct sequence" here however as the obstacles are reused
-auto drawObstacles(obstacle &currentObstacle) -> void
+//Moves the cursor, with rows and columns counted from 1 like the terminal does
+auto encodeMove(ansiencoder &encoder, int row, int col) -> void
 {
+    encoder.bytes += "\033[";
+    encodeNumber(encoder, static_cast<unsigned int>(row));
+    encoder.bytes += ';';
+    encodeNumber(encoder, static_cast<unsigned int>(col));
+    encoder.bytes += 'H';
+}
 
-    if (currentObstacle.position.col == -1)
+//Changes the attributes for the glyphs after it, with a single SGR sequence that only has what is different. Bold can only be turned off by resetting everything, so then the colour goes back on after
+auto encodeStyle(ansiencoder &encoder, unsigned int colour, bool bold) -> void
+{
+    if (colour == encoder.colour and bold == encoder.bold)
     {
-        MoveTo(currentObstacle.position.row, 0);
-        cout << "\033[1m\033[32m"
-             << " | " << flush;
-        MoveTo(currentObstacle.position.row + 1, 0);
-        cout << "_| " << flush;
-        MoveTo(currentObstacle.position.row + 2, 0);
-        cout << "|  "
-             << "\033[0m" << flush;
+        return;
     }
-
-    else if (currentObstacle.position.col == -2)
+    encoder.bytes += "\033[";
+    const bool reset{encoder.bold and not bold};
+    if (reset)
+    {
+        encoder.bytes += '0';
+        encoder.colour = COLOUR_IGNORE;
+    }
+    if (bold and not encoder.bold)
+    {
+        encoder.bytes += '1';
+    }
+    if (colour != encoder.colour)
     {
-        MoveTo(currentObstacle.position.row, 0);
-        cout << "\033[1m\033[32m"
-             << "| " << flush;
-        MoveTo(currentObstacle.position.row + 1, 0);
-        cout << "| " << flush;
-        MoveTo(currentObstacle.position.row + 2, 0);
-        cout << "  "
-             << "\033[0m" << flush;
+        if (encoder.bytes.back() != '[')
+        {
+            encoder.bytes += ';';
+        }
+        encodeNumber(encoder, colour == COLOUR_IGNORE ? 39 : colour); //39 is the terminal's own foreground colour
     }
+    encoder.bytes += 'm';
+    encoder.colour = colour;
+    encoder.bold = bold;
+}
 
-    else if (currentObstacle.position.col <= -3)
+//Puts the terminal back to plain text, for when something other than a frame is written next
+auto encodeReset(ansiencoder &encoder) -> void
+{
+    if (encoder.colour != COLOUR_IGNORE or encoder.bold)
     {
-        MoveTo(currentObstacle.position.row, 0);
-        cout << "\033[1m\033[32m"
-             << " " << flush;
-        MoveTo(currentObstacle.position.row + 1, 0);
-        cout << " " << flush;
-        MoveTo(currentObstacle.position.row + 2, 0);
-        cout << " "
-             << "\033[0m" << flush;
-        currentObstacle.position.col = screenLength;
-        currentObstacle.velocity = obvelocity(generator);
+        encoder.bytes += STOP_COLOUR;
+        encoder.colour = COLOUR_IGNORE;
+        encoder.bold = false;
     }
+}
 
+auto encodeGlyph(ansiencoder &encoder, char32_t glyph) -> void
+{
+    string &output{encoder.bytes};
+    if (glyph < 0x80)
+    {
+        output += static_cast<char>(glyph);
+    }
+    else if (glyph < 0x800)
+    {
+        output += static_cast<char>(0xC0 | (glyph >> 6));
+        output += static_cast<char>(0x80 | (glyph & 0x3F));
+    }
+    else if (glyph < 0x10000)
+    {
+        output += static_cast<char>(0xE0 | (glyph >> 12));
+        output += static_cast<char>(0x80 | ((glyph >> 6) & 0x3F));
+        output += static_cast<char>(0x80 | (glyph & 0x3F));
+    }
     else
     {
-        MoveTo(currentObstacle.position.row, currentObstacle.position.col);
-        cout << "\033[1m\033[32m"
-             << "| | " << flush;
-        MoveTo(currentObstacle.position.row + 1, currentObstacle.position.col);
-        cout << "|_| " << flush;
-        MoveTo(currentObstacle.position.row + 2, currentObstacle.position.col);
-        cout << " |  "
-             << "\033[0m" << flush;
+        output += static_cast<char>(0xF0 | (glyph >> 18));
+        output += static_cast<char>(0x80 | ((glyph >> 12) & 0x3F));
+        output += static_cast<char>(0x80 | ((glyph >> 6) & 0x3F));
+        output += static_cast<char>(0x80 | (glyph & 0x3F));
     }
 }
-//same as moveClouds but for the obstacles
-auto moveObstacles(obstacle &currentObstacle) -> void
-{
 
-    currentObstacle.position.col -= currentObstacle.velocity;
+//Builds the escape codes that turn the front grid into the back grid. Only runs of changed cells are sent, the cursor is only moved when a run doesn't continue where the last one stopped,
+//and attributes are only sent when they differ from what the terminal already has. Afterwards the grids are swapped, so the back grid holds stale cells until the next clearFramebuffer.
+//With clearTerminal the frame starts by blanking the terminal and its attributes, for when the front grid has just been made blank too
+auto presentFramebuffer(framebuffer &screen, bool clearTerminal = false) -> const string &
+{
+    SCOPED_SPAN("presentFramebuffer");
+    ansiencoder &encoder{screen.encoder};
+    encoder.bytes.clear();
+    if (clearTerminal)
+    {
+        encoder.bytes += STOP_COLOUR; //whatever reads this might not have seen the frames before, so the attributes are put in a known state too
+        encoder.colour = COLOUR_IGNORE;
+        encoder.bold = false;
+        encodeControl(encoder, "2J");
+    }
+    int cursorRow{-1};
+    int cursorCol{-1};
+    for (int row = 0; row < screen.rows; row += 1)
+    {
+        const size_t rowStart{static_cast<size_t>(row * screen.cols)};
+        for (int col = 0; col < screen.cols; col += 1)
+        {
+            const cell &wanted{screen.back[rowStart + col]};
+            if (wanted == screen.front[rowStart + col])
+            {
+                continue;
+            }
+            //a short gap of unchanged cells in the current colour (or blanks, which look the same in any colour) is cheaper to write again than to jump over with a cursor move
+            if (row == cursorRow and col > cursorCol and col - cursorCol <= 4)
+            {
+                bool sameColour{true};
+                for (int gap = cursorCol; gap < col; gap += 1)
+                {
+                    const cell &skipped{screen.back[rowStart + gap]};
+                    sameColour = sameColour and (skipped.glyph == U' ' or (skipped.colour == encoder.colour and skipped.bold == encoder.bold));
+                }
+                for (int gap = cursorCol; sameColour and gap < col; gap += 1)
+                {
+                    encodeGlyph(encoder, screen.back[rowStart + gap].glyph);
+                }
+                if (sameColour)
+                {
+                    cursorCol = col;
+                }
+            }
+            if (row != cursorRow or col != cursorCol)
+            {
+                encodeMove(encoder, row + 1, col + 1);
+            }
+            //a blank looks the same in any colour, so it is written in whatever the terminal has
+            if (wanted.glyph != U' ')
+            {
+                encodeStyle(encoder, wanted.colour, wanted.bold);
+            }
+            encodeGlyph(encoder, wanted.glyph);
+            cursorRow = row;
+            cursorCol = col + 1;
+        }
+    }
+    swap(screen.front, screen.back);
+    return encoder.bytes;
 }
-//changes the players current row and column to follow that of a parabola for realistic movement
-auto jumpPlayer(player &player) -> void
+
+//Picks where frames go from --output. A file that can't be opened is logged and the frames go nowhere instead
+auto openOutput(const string &path) -> outputsink
 {
-    //Calculates the vertical component of the player as a quadratic, providing realistic movement. 
-    //t represents the "independent variable" it can be thought of as "frames" of an animation
-    t += 1;
-    if (t <= 6) //once the jump animation begins, it can not be stopped until t = 0 again this both stops players from jumping through the sky and ensures the jump cant be cancelled early
+    if (path.empty())
     {
-        player.position.row = (screenWidth - 1) - (-pow((t - 3), 2) + 9); //This was the function for the parabola
-        player.position.col += 2;
+        return {.kind = OUTPUT_TTY, .fd = fileno(stdout)};
     }
-    else
+    if (path == "null")
     {
-        t = 0;
+        return {.kind = OUTPUT_NULL};
+    }
+    const int fd{open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    if (fd < 0)
+    {
+        logText(LOG_ERROR, "Error opening output, frames will be thrown away", path);
+        return {.kind = OUTPUT_NULL};
     }
+    return {.kind = OUTPUT_FILE, .fd = fd};
 }
-//Same as drawClouds, but obviously a lot shorter as it only has 1 possible visual state it can be in, and only 1 row
-auto drawPlayer(player &player) -> void
+
+auto closeOutput(outputsink &sink) -> void
+{
+    logNumber(LOG_INFO, "Frames written", sink.frames);
+    logNumber(LOG_INFO, "Calls to write(2) for them", sink.writes);
+    logNumber(LOG_INFO, "Bytes written", sink.bytes);
+    if (sink.kind == OUTPUT_FILE)
+    {
+        close(sink.fd);
+    }
+}
+
+auto copyIntoRing(span<char> ring, uint64_t at, const char *from, size_t count) -> void
 {
-    MoveTo(player.position.row, player.position.col);
-    cout << "\033[1m\033[34m"
-         << "Σ(⊃≧ᴗ≦)⊃" //cute 
-         << "\033[0m" << flush;
+    const size_t offset{static_cast<size_t>(at & (ring.size() - 1))};
+    const size_t first{min(count, ring.size() - offset)};
+    memcpy(ring.data() + offset, from, first);
+    memcpy(ring.data(), from + first, count - first);
 }
-//The ground is drawn at the start but isn't touched again as it doesn't move
-auto drawGround(ground &ground) -> void
+
+auto copyFromRing(span<const char> ring, uint64_t at, char *to, size_t count) -> void
+{
+    const size_t offset{static_cast<size_t>(at & (ring.size() - 1))};
+    const size_t first{min(count, ring.size() - offset)};
+    memcpy(to, ring.data() + offset, first);
+    memcpy(to + first, ring.data(), count - first);
+}
+
+//Queues an event for the recording. Returns false when it was dropped because the writer thread is too far behind for it to fit
+auto castEvent(castrecorder &cast, char kind, string_view bytes) -> bool
 {
-    MoveTo(ground.position.row, ground.position.col);
-    cout << "\033[1m\033[30m";
-    for (int i = 0; i < screenLength - 1; i++)
+    const uint64_t tail{cast.tail.load(memory_order_relaxed)};
+    const size_t needed{sizeof(castentry) + bytes.size()};
+    if (tail + needed - cast.head.load(memory_order_acquire) > CAST_RING_BYTES)
     {
-        cout << "‾";
+        cast.dropped.fetch_add(1, memory_order_relaxed);
+        return false;
     }
-    cout << "‾"
-         << "\033[0m" << flush;
+    const castentry entry{.time = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - cast.start).count(), .length = static_cast<uint32_t>(bytes.size()), .kind = kind};
+    copyIntoRing(cast.ring, tail, reinterpret_cast<const char *>(&entry), sizeof(entry));
+    copyIntoRing(cast.ring, tail + sizeof(entry), bytes.data(), bytes.size());
+    cast.tail.store(tail + needed, memory_order_release);
+    return true;
 }
 
-//This function positions the scoreboard at the top center and colors it red.
-auto drawScore(position scoreposition, unsigned int ticks) -> void
+auto castResize(castrecorder &cast, int rows, int cols) -> void
 {
-    MoveTo(scoreposition.row, scoreposition.col);
-    cout << "\033[1m\033[91m"
-         << "Score: " << score << " Time: " << static_cast<float>(ticks / 10) << "s"
-         << "\033[0m" << flush;
+    char size[32];
+    const int length{snprintf(size, sizeof(size), "%dx%d", cols, rows)};
+    castEvent(cast, 'r', {size, static_cast<size_t>(length)});
 }
 
-//Fixes the end position so that the command line does not appear after the scoreboard (ruining the visuals)
-auto endPosition() -> void
+//Writes everything, or as much as the file will take. A recording that can't be written is lost rather than holding anything up
+auto writeCastLines(castrecorder &cast) -> void
 {
-    MoveTo(screenWidth, screenLength/2);
+    for (size_t written = 0; written < cast.lines.size();)
+    {
+        const ssize_t result{write(cast.fd, cast.lines.data() + written, cast.lines.size() - written)};
+        if (result <= 0 and errno != EINTR)
+        {
+            break;
+        }
+        written += static_cast<size_t>(max(result, ssize_t{0}));
+    }
+    cast.lines.clear();
 }
 
-//Function will ensure no character column of the player is touching any character column of the obstacle below 3 units. If one or more characters are touching, this function signals that the game is over.
-auto checkCollision(obstacle ob, player character) -> bool
+//The cast writer thread. Every CAST_FLUSH_INTERVAL it turns everything in the ring into asciicast v2 lines, [seconds, "o", "frame"], with each frame escaped as a JSON string.
+//Frames are always whole UTF-8, so only quotes, backslashes and control characters need escaping. The bytes are escaped straight out of the ring, a little at a time
+auto writeCast(castrecorder &cast) -> void
 {
-    bool alreadyScored{false};
-    bool gameOver {false};
-    for (int characterlength = -1 ; characterlength <= 10; characterlength += 1) //we oversized the hitboxes of the player as the terminal was being a bit too generous
+    const char *const HEX{"0123456789abcdef"};
+    bool keepGoing{true};
+    while (keepGoing)
     {
-        for (int oblength = 0; oblength <= 3; oblength += 1)
+        keepGoing = cast.running.load(memory_order_acquire); //read before draining, so the frames queued before stopCasting are always written
+        uint64_t head{cast.head.load(memory_order_relaxed)};
+        const uint64_t tail{cast.tail.load(memory_order_acquire)};
+        while (head != tail)
         {
-            if ((character.position.col + characterlength) == (ob.position.col + oblength))
+            castentry entry{};
+            copyFromRing(cast.ring, head, reinterpret_cast<char *>(&entry), sizeof(entry));
+            char prefix[48];
+            const int length{snprintf(prefix, sizeof(prefix), "[%.6f, \"%c\", \"", static_cast<double>(entry.time) / 1e9, entry.kind)};
+            cast.lines.append(prefix, static_cast<size_t>(length));
+            for (uint64_t at = head + sizeof(entry); at < head + sizeof(entry) + entry.length; at += 1)
             {
-                if (character.position.row >= (screenWidth - 3))
+                const char byte{cast.ring[at & (CAST_RING_BYTES - 1)]};
+                if (byte == '"' or byte == '\\')
+                {
+                    cast.lines += '\\';
+                    cast.lines += byte;
+                }
+                else if (static_cast<unsigned char>(byte) < 0x20)
+                {
+                    cast.lines += "\\u00";
+                    cast.lines += HEX[byte >> 4];
+                    cast.lines += HEX[byte & 0xF];
+                }
+                else
                 {
-                    gameOver = true;
+                    cast.lines += byte;
                 }
-                else if (character.position.row < (screenWidth - 3) and oblength == 3 and characterlength >= 5 and alreadyScored == false) //If a character column of the player touches a character column of the obstacle but isnt below 3 units, 1 score is added
+                if (cast.lines.size() >= CAST_WRITE_BYTES)
                 {
-                    score += 1;
-                    alreadyScored = true;
+                    writeCastLines(cast);
                 }
             }
+            cast.lines += "\"]\n";
+            head += sizeof(entry) + entry.length;
+            cast.head.store(head, memory_order_release); //hands the space back as soon as each frame is done, so a big batch doesn't keep the ring full
+        }
+        writeCastLines(cast);
+        if (keepGoing)
+        {
+            this_thread::sleep_for(CAST_FLUSH_INTERVAL);
         }
     }
-    return gameOver;
 }
 
-//This function prints some creative ascii art when the game ends
-auto gameOverScreen( unsigned int ticks) -> void{
-
-        MoveTo(screenWidth/2 - 13, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼" << flush;
-
-        MoveTo(screenWidth/2 - 12, screenLength/2 - 19);
-        cout << "███▀▀▀██┼███▀▀▀███┼███▀█▄█▀███┼██▀▀▀" << flush;
-
-        MoveTo(screenWidth/2 - 11, screenLength/2 - 19);
-        cout << "██┼┼┼┼██┼██┼┼┼┼┼██┼██┼┼┼█┼┼┼██┼██┼┼┼" << flush;
-
-        MoveTo(screenWidth/2 - 10, screenLength/2 - 19);
-        cout << "██┼┼┼▄▄▄┼██▄▄▄▄▄██┼██┼┼┼▀┼┼┼██┼██▀▀▀" << flush;
-
-        MoveTo(screenWidth/2 - 9, screenLength/2 - 19);
-        cout << "██┼┼┼┼██┼██┼┼┼┼┼██┼██┼┼┼┼┼┼┼██┼██┼┼┼" << flush;
-
-        MoveTo(screenWidth/2 - 8, screenLength/2 - 19);
-        cout << "███▄▄▄██┼██┼┼┼┼┼██┼██┼┼┼┼┼┼┼██┼██▄▄▄" << flush;
-
-        MoveTo(screenWidth/2 - 7, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼" << flush;
-
-        MoveTo(screenWidth/2 - 6, screenLength/2 - 19);
-        cout << "███▀▀▀███┼▀███┼┼██▀┼██▀▀▀┼██▀▀▀▀██▄┼" << flush;
-
-        MoveTo(screenWidth/2 - 5, screenLength/2 - 19);
-        cout << "██┼┼┼┼┼██┼┼┼██┼┼██┼┼██┼┼┼┼██┼┼┼┼┼██┼" << flush;
-
-        MoveTo(screenWidth/2 - 4, screenLength/2 - 19);
-        cout << "██┼┼┼┼┼██┼┼┼██┼┼██┼┼██▀▀▀┼██▄▄▄▄▄▀▀┼" << flush;
-
-        MoveTo(screenWidth/2 - 3, screenLength/2 - 19);
-        cout << "██┼┼┼┼┼██┼┼┼██┼┼█▀┼┼██┼┼┼┼██┼┼┼┼┼██┼" << flush;
-
-        MoveTo(screenWidth/2 - 2, screenLength/2 - 19);
-        cout << "███▄▄▄███┼┼┼─▀█▀┼┼─┼██▄▄▄┼██┼┼┼┼┼██▄" << flush;
-
-        MoveTo(screenWidth/2 - 1, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼" << flush;
-
-        MoveTo(screenWidth/2 , screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼██┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼██┼┼┼┼┼┼┼┼┼" << flush;
-
-        MoveTo(screenWidth/2 + 1, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼████▄┼┼┼▄▄▄▄▄▄▄┼┼┼▄████┼┼┼┼┼┼┼" << flush;
-
-        MoveTo(screenWidth/2 + 2, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼▀▀█▄█████████▄█▀▀┼┼┼┼┼┼┼┼┼┼" << flush;
-
-        MoveTo(screenWidth/2 + 3, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼┼█████████████┼┼┼┼┼┼┼┼┼┼┼┼" << flush;
+//Opens the recording, writes the asciicast header for a terminal of this size and starts the writer thread. The cursor is hidden at the start like it is in the game
+auto startCasting(castrecorder &cast, const string &path, int rows, int cols, uint64_t seed) -> bool
+{
+    cast.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (cast.fd < 0)
+    {
+        return false;
+    }
+    cast.ring.resize(CAST_RING_BYTES);
+    cast.lines.reserve(CAST_WRITE_BYTES + 64);
+    cast.start = chrono::steady_clock::now();
+    char header[160];
+    const int length{snprintf(header, sizeof(header), "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld, \"title\": \"Dinosaur game, seed %llu\"}\n", cols, rows,
+                              static_cast<long long>(time(nullptr)), static_cast<unsigned long long>(seed))};
+    cast.lines.append(header, static_cast<size_t>(length));
+    writeCastLines(cast);
+    castEvent(cast, 'o', "\033[?25l");
+    cast.running.store(true, memory_order_release);
+    cast.writer = thread{writeCast, ref(cast)};
+    return true;
+}
 
-        MoveTo(screenWidth/2 + 4, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼┼██▀▀▀███▀▀▀██┼┼┼┼┼┼┼┼┼┼┼┼" << flush;
+//Waits for the writer thread to write everything that was queued, then closes the recording
+auto stopCasting(castrecorder &cast) -> void
+{
+    if (not cast.writer.joinable())
+    {
+        return;
+    }
+    castEvent(cast, 'o', "\033[?25h");
+    cast.running.store(false, memory_order_release);
+    cast.writer.join();
+    close(cast.fd);
+    logNumber(cast.dropped.load() > 0 ? LOG_WARN : LOG_INFO, "Frames dropped from the recording with the disk behind", cast.dropped.load());
+}
 
-        MoveTo(screenWidth/2 + 5, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼┼██┼┼┼███┼┼┼██┼┼┼┼┼┼┼┼┼┼┼┼" << flush;
+//The shared memory name of a --broadcast ring
+auto spectateName(const string &name) -> string
+{
+    return "/dinosaur-" + name;
+}
 
-        MoveTo(screenWidth/2 + 6, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼┼█████▀▄▀█████┼┼┼┼┼┼┼┼┼┼┼┼" << flush;
+//Makes the shared memory for --broadcast. Spectators can attach as soon as the first keyframe is in it. A name another game is broadcasting under is left alone
+auto startBroadcast(broadcaster &broadcast, const string &name) -> bool
+{
+    if (name.empty() or name.find('/') != string::npos)
+    {
+        return false;
+    }
+    const int fd{shm_open(spectateName(name).c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644)};
+    if (fd < 0)
+    {
+        if (errno == EEXIST)
+        {
+            logText(LOG_ERROR, "Another game is already broadcasting as", name);
+        }
+        return false;
+    }
+    const size_t size{sizeof(spectateheader) + SPECTATE_RING_BYTES};
+    void *mapping{ftruncate(fd, static_cast<off_t>(size)) == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED};
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        shm_unlink(spectateName(name).c_str());
+        return false;
+    }
+    broadcast.header = new (mapping) spectateheader{};
+    broadcast.header->capacity = SPECTATE_RING_BYTES;
+    atomic_thread_fence(memory_order_release); //the magic goes in last, so a spectator that sees it and then fences sees the rest too
+    copy(begin(SPECTATE_MAGIC), end(SPECTATE_MAGIC), broadcast.header->magic);
+    broadcast.ring = {static_cast<char *>(mapping) + sizeof(spectateheader), SPECTATE_RING_BYTES};
+    broadcast.name = name;
+    return true;
+}
 
-        MoveTo(screenWidth/2 + 7, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼┼┼███████████┼┼┼┼┼┼┼┼┼┼┼┼┼" << flush;
+//Tells the spectators the game is over and takes the name away. Spectators still attached keep the memory until they have shown the last frame
+auto stopBroadcast(broadcaster &broadcast) -> void
+{
+    if (broadcast.header == nullptr)
+    {
+        return;
+    }
+    broadcast.header->finished.store(true, memory_order_release);
+    munmap(broadcast.header, sizeof(spectateheader) + broadcast.ring.size());
+    shm_unlink(spectateName(broadcast.name).c_str());
+    logNumber(LOG_INFO, "Frames broadcast", broadcast.sequence);
+    logNumber(LOG_INFO, "Keyframes broadcast", broadcast.keyframes);
+}
 
-        MoveTo(screenWidth/2 + 8, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼▄▄▄██┼┼█▀█▀█┼┼██▄▄▄┼┼┼┼┼┼┼┼┼" << flush;
+//Puts a frame in the spectator ring. The space is claimed before it is written and published after, so a spectator can always tell whether what it copied was whole
+auto publishFrame(broadcaster &broadcast, string_view bytes, bool keyframe) -> void
+{
+    spectateheader &header{*broadcast.header};
+    const size_t needed{(sizeof(spectateentry) + bytes.size() + 7) / 8 * 8};
+    if (needed > broadcast.ring.size() / 2)
+    {
+        logNumber(LOG_WARN, "Frame too big for the spectators, bytes", bytes.size());
+        return;
+    }
+    const uint64_t at{header.published.load(memory_order_relaxed)};
+    const spectateentry entry{.sequence = broadcast.sequence, .length = static_cast<uint32_t>(bytes.size()), .keyframe = keyframe};
+    header.claimed.store(at + needed, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    copyIntoRing(broadcast.ring, at, reinterpret_cast<const char *>(&entry), sizeof(entry));
+    copyIntoRing(broadcast.ring, at + sizeof(entry), bytes.data(), bytes.size());
+    header.published.store(at + needed, memory_order_release);
+    if (keyframe)
+    {
+        header.keyframe.store(at, memory_order_release);
+    }
+    broadcast.sequence += 1;
+}
 
-        MoveTo(screenWidth/2 + 9, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼▀▀██┼┼┼┼┼┼┼┼┼┼┼██▀▀┼┼┼┼┼┼┼┼┼" << flush;
+//Every SPECTATE_KEYFRAME_INTERVAL the screen that was just presented goes into the ring again, drawn from blank, for spectators to start from. It finishes in the attributes the
+//game's terminal has, since the frames after it carry on from those. This is the only work broadcasting adds to a frame, and it is the same whoever is watching
+auto broadcastKeyframe(broadcaster &broadcast, const framebuffer &screen, chrono::steady_clock::time_point now) -> void
+{
+    if (now - broadcast.lastKeyframe < SPECTATE_KEYFRAME_INTERVAL)
+    {
+        return;
+    }
+    SCOPED_SPAN("broadcastKeyframe");
+    framebuffer &keyframe{broadcast.keyframe};
+    keyframe.rows = screen.rows;
+    keyframe.cols = screen.cols;
+    keyframe.back.assign(screen.front.begin(), screen.front.end());
+    keyframe.front.assign(screen.front.size(), cell{});
+    presentFramebuffer(keyframe, true);
+    encodeStyle(keyframe.encoder, screen.encoder.colour, screen.encoder.bold);
+    publishFrame(broadcast, keyframe.encoder.bytes, true);
+    broadcast.lastKeyframe = now;
+    broadcast.keyframes += 1;
+}
 
-        MoveTo(screenWidth/2 + 10, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼▀▀┼┼┼┼┼┼┼┼┼┼┼▀▀┼┼┼┼┼┼┼┼┼┼┼" << flush;
+//Sends a whole frame with one write(2). It only takes more when the kernel takes part of it, or when the terminal shares stdin's non-blocking mode and is full, in which case it waits
+//until the terminal can take more. That wait is what tells renderFrames the terminal is slow
+auto writeFrame(outputsink &sink, string_view bytes) -> void
+{
+    sink.frames += 1;
+    sink.bytes += bytes.size();
+    if (sink.cast != nullptr and not castEvent(*sink.cast, 'o', bytes))
+    {
+        sink.needsKeyframe = true;
+    }
+    if (sink.broadcast != nullptr)
+    {
+        publishFrame(*sink.broadcast, bytes, false);
+    }
+    if (sink.kind == OUTPUT_NULL)
+    {
+        return;
+    }
+    while (not bytes.empty())
+    {
+        const ssize_t written{write(sink.fd, bytes.data(), bytes.size())};
+        sink.writes += 1;
+        if (written >= 0)
+        {
+            bytes.remove_prefix(static_cast<size_t>(written));
+        }
+        else if (errno == EAGAIN)
+        {
+            pollfd ready{.fd = sink.fd, .events = POLLOUT, .revents = 0};
+            poll(&ready, 1, -1);
+        }
+        else if (errno != EINTR)
+        {
+            logNumber(LOG_ERROR, "Error writing a frame, errno", static_cast<uint64_t>(errno));
+            return;
+        }
+    }
+}
 
-        MoveTo(screenWidth/2 + 11, screenLength/2 - 19);
-        cout << "┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼┼" << flush;
+auto resetArena(framearena &arena, size_t capacity) -> void
+{
+    arena.memory.resize(capacity);
+    arena.used = 0;
+}
 
-        cout << "\033[1m\033[91m"
-         << "Score: " << score << " Time: " << static_cast<float>(ticks / 10) << "s"
-         << "\033[0m" << flush;
-        endPosition();
+//Space for count Ts that stays valid until the arena is cleared. The arena is sized up front for the most a tick can ask for, so running out means that sizing is wrong
+template <typename T>
+auto arenaAllocate(framearena &arena, size_t count) -> span<T>
+{
+    const size_t start{(arena.used + alignof(T) - 1) / alignof(T) * alignof(T)};
+    if (start + count * sizeof(T) > arena.memory.size())
+    {
+        logNumber(LOG_ERROR, "Frame arena is too small for this many more entries", count);
+        return {};
+    }
+    arena.used = start + count * sizeof(T);
+    return {reinterpret_cast<T *>(arena.memory.data() + start), count};
 }
 
-//if the right side of the player touches the side of the screen, the function signals that the process for a win should begin
-auto checkWon( player character) -> bool{
-    bool gameWon = false;
+//Empties the clouds and makes room for capacity of them. This is the only place the clouds allocate
+auto resetClouds(cloudfield &clouds, size_t capacity) -> void
+{
+    clouds.row.resize(capacity);
+    clouds.col.resize(capacity);
+    clouds.velocity.resize(capacity);
+    clouds.alive.resize(capacity);
+    clouds.count = 0;
+}
 
-    if(character.position.col >= screenLength-8){
-        gameWon = true;
+//Adds a cloud if there is room for it
+auto placeCloud(cloudfield &clouds, position at, int velocity) -> void
+{
+    if (clouds.count == clouds.row.size())
+    {
+        return;
     }
-
-    return gameWon; 
+    clouds.row[clouds.count] = at.row;
+    clouds.col[clouds.count] = at.col;
+    clouds.velocity[clouds.count] = velocity;
+    clouds.alive[clouds.count] = 1;
+    clouds.count += 1;
 }
-//Some more awesome ascii art 
-auto gameWonScreen(  unsigned int ticks ) -> void{
-    MoveTo( screenWidth/2 -15, screenLength/2 -36);
-    cout << "                                ,.        ,.      ,.                        " << "\n" << flush;
-    cout << "                                ||        ||      ||  ()                    " << "\n"<< flush;
-    cout << " ,--. ,-. ,.,-.  ,--.,.,-. ,-.  ||-.,.  ,.|| ,-.  ||-.,. ,-. ,.,-.  ,--.    " << "\n"<< flush;
-    cout << "//`-'//-\\||/|| //-||||/`'//-\\ ||-'||  ||||//-\\ ||-'||//-\\||/|| ((`-'    " << "\n"<< flush;
-    cout << "||   || |||| ||||  ||||   || || ||  || /|||||| || ||  |||| |||| ||  ``.     " << "\n"<< flush;
-    cout << "\\,-.\\-//|| || \\-||||   \\-|| ||  ||//||||\\-|| ||  ||\\-//|| || ,-.))    " << "\n"<< flush;
-    cout << " `--' `-' `' `'  `-,|`'    `-^-``'  `-' `'`' `-^-``'  `' `-' `' `' `--'     " << "\n"<< flush;
-    cout << "                  //           .--------.                                   " << "\n"<< flush;
-    cout << "              ,-.//          .: : :  :___`.                                 " << "\n"<< flush;
-    cout << "              `--'         .'!!:::::  \\_| `.                               " << "\n"<< flush;
-    cout << "                      : . /%O!!::::::::\\_|. |                              " << "\n"<< flush;
-    cout << "                     [""]/%%O!!:::::::::  : . |                             " << "\n"<< flush;
-    cout << "                     |  |%%OO!!::::::::::: : . |                            " << "\n"<< flush;
-    cout << "                     |  |%%OO!!:::::::::::::  :|                            " << "\n"<< flush;
-    cout << "                     |  |%%OO!!!::::::::::::: :|                            " << "\n"<< flush;
-    cout << "            :       .'--`.%%OO!!!:::::::::::: :|                            " << "\n"<< flush;
-    cout << "          : .:     /`.__.'|%%OO!!!::::::::::::/                             " << "\n"<< flush;
-    cout << "         :    .   /        |%OO!!!!::::::::::/                              " << "\n"<< flush;
-    cout << "        ,-'``'-. ;          ;%%OO!!!!!!:::::'                               " << "\n"<< flush;
-    cout << "        |`-..-'| |   ,--.   |`%%%OO!!!!!!:'                                 " << "\n"<< flush;
-    cout << "        | .   :| |_.','`.`._|  `%%%OO!%%'                                   " << "\n"<< flush;
-    cout << "        | . :  | |--'    `--|    `%%%%'                                     " << "\n"<< flush;
-    cout << "        |`-..-'| ||   | | | |     /__|`-.                                   " << "\n"<< flush;
-    cout << "        |::::::/ ||)|/|)|)|||           /                                   " << "\n"<< flush;
-    cout << "---------`::::'--|._ ~**~ _.|----------( -----------------------            " << "\n"<< flush;
-    cout << "           )(    |  `-..-'  |           |    ______                         " << "\n"<< flush;
-    cout << "           )(    |          |,--.       ____/ /  /\\ ,-._.-'                " << "\n"<< flush;
-    cout << "        ,-')('-. |          ||`;/   .-()___  :  |`.!,-'`'/`-._              " << "\n"<< flush;
-    cout << "       (  '  `  )`-._    _.-'|;,|    `-,    |_|__|`,-'>-.,-._               " << "\n"<< flush;
-    cout << "        `-....-'     ````    `--'      `-._       (`- `-._`-.               " << "\n"<< flush;
-     cout << "\033[1m\033[91m"
-         << "Score: " << score << " Time: " << static_cast<float>(ticks / 10) << "s"
-         << "\033[0m" << flush;
-    
-    endPosition();
-}
-
-auto main() -> int
+
+//Makes a cloud somewhere in the sky, or at the right edge for clouds that are just arriving. The random numbers are always drawn, even when there is no room for the cloud, so the rest of the game plays out the same
+auto spawnCloud(world &game, bool atRightEdge) -> void
 {
-    // Set Up the system to receive input
-    SetupScreenAndInput();
+    cloudfield &clouds{game.clouds};
+    const int row{randomBetween(game.generator, 0, game.screenWidth / 2 + game.screenWidth / 10)}; //This code makes sure the clouds spawn outside of the play area
+    const int col{randomBetween(game.generator, 0, game.screenLength)};
+    const int velocity{randomFrom(cloudvelocity, game.generator)};
+    placeCloud(clouds, {row, atRightEdge ? game.screenLength - 1 : col}, velocity);
+}
 
-    // Check that the terminal size is large enough for our fishies
-    const position TERMINAL_SIZE{GetTerminalSize()};
-    if ((TERMINAL_SIZE.row < 30) or (TERMINAL_SIZE.col < 100))
+//This function draws every cloud. Clouds entering on the right or leaving on the left are just clipped by blitSprite.
+//behind is how much of the last tick is still to be shown (see renderFrames). A cloud was velocity columns further right a tick ago, so it is drawn that far back along its path
+auto drawClouds(framebuffer &screen, const cloudfield &clouds, double behind = 0, int cameraShift = 0) -> void
+{
+    SCOPED_SPAN("drawClouds");
+    for (size_t cloud = 0; cloud < clouds.count; cloud += 1)
     {
-        ShowCursor();
-        TeardownScreenAndInput();
-        cout << endl
-             << "Terminal window must be at least 30 by 100 to run this game" << endl;
-        return EXIT_FAILURE;
+        blitSprite(screen, CLOUD_SPRITE, {clouds.row[cloud], clouds.col[cloud] + static_cast<int>(lround((clouds.velocity[cloud] + cameraShift / 2) * behind))});
     }
-    // State Variables
-    unsigned int ticks{0};
-    uniform_int_distribution<unsigned int> cloudgenerator(3, 8);
-    uniform_int_distribution<unsigned int> chanceOfCloud(1, 10);
-    unsigned int chanceForCloud;
-    position screenSize = GetTerminalSize();
-    screenWidth = screenSize.row;  //screenWidth;
-    screenLength = screenSize.col; //screenLength
-    position scoreposition{1, (screenLength / 2) - 18}; //set the position to the top center. The -18 is to center the text, otherwise the left side of the text would start at the middle
-    bool collided1{false};
-    bool collided2{false};
-    bool collided3{false};
+}
 
-    player playercharacter{.position = {(screenWidth - 1), 0}};
-    cloudvector clouds{}; //stores all of the clouds that will be generated and destroyed
-    ground ground{.position = {(screenWidth), 0}}; //sets ground position to the bottom of the screen
+//This function updates the position of each cloud according to its inherent velocity, and destroys the clouds that are completely past the left edge.
+//The first loop is the one that runs over every cloud every tick, so it is kept to plain arithmetic on the arrays that the compiler can vectorise. Only when a cloud has died
+//are the survivors packed back to the front, again without branching: every cloud is copied down, and the write position only moves past the ones still alive
+auto moveClouds(cloudfield &clouds) -> void
+{
+    SCOPED_SPAN("moveClouds");
+    int *row{clouds.row.data()};
+    int *col{clouds.col.data()};
+    int *velocity{clouds.velocity.data()};
+    unsigned char *alive{clouds.alive.data()};
+    const size_t count{clouds.count};
 
-    //generate anywhere from 3 to 8 clouds at the beginning
-    for (unsigned int clouditerator = 0; clouditerator <= cloudgenerator(generator); clouditerator++)
+    size_t survivors{0};
+    for (size_t cloud = 0; cloud < count; cloud += 1)
+    {
+        alive[cloud] = col[cloud] + CLOUD_SPRITE.width > 0;
+        col[cloud] -= velocity[cloud];
+        survivors += alive[cloud];
+    }
+    if (survivors == count)
+    {
+        return;
+    }
+    size_t kept{0};
+    for (size_t cloud = 0; cloud < count; cloud += 1)
     {
-        cloud newCloud;
-        clouds.push_back(newCloud);
+        const unsigned char keep{alive[cloud]};
+        row[kept] = row[cloud];
+        col[kept] = col[cloud];
+        velocity[kept] = velocity[cloud];
+        alive[kept] = 1;
+        kept += keep;
     }
+    clouds.count = kept;
+}
 
-    // obstacle ob1{.position = {screenWidth - 3, obspawns(generator)}};
-    // obstacle ob2{.position = {screenWidth - 3, obspawns(generator)}};
-    // obstacle ob3{.position = {screenWidth - 3, obspawns(generator)}};
+//same as drawClouds but for the obstacles
+auto drawObstacles(framebuffer &screen, const obstaclefield &obstacles, double behind = 0, int cameraShift = 0) -> void
+{
+    for (size_t ob = 0; ob < obstacles.count and obstacles.col[ob] != OBSTACLE_PARKED; ob += 1)
+    {
+        blitSprite(screen, CACTUS_SPRITE, {obstacles.row[ob], obstacles.col[ob] + static_cast<int>(lround((obstacles.velocity[ob] + cameraShift) * behind))}); //one that came back this tick slides in from past the right edge
+    }
+}
 
-    //Again the function from the random class did not want to work with screenLength and screenWidth
-    obstacle ob1{.position = {screenWidth - 3, experimental::randint(100, screenLength)}};
-    obstacle ob2{.position = {screenWidth - 3, experimental::randint(100, screenLength)}};
-    obstacle ob3{.position = {screenWidth - 3, experimental::randint(100, screenLength)}};
+//Insertion sort by column. The obstacles only move a few columns a tick so they are almost always still in order and this is close to a single pass
+auto sortObstacles(obstaclefield &obstacles) -> void
+{
+    for (size_t i = 1; i < obstacles.count; i += 1)
+    {
+        const int row{obstacles.row[i]};
+        const int col{obstacles.col[i]};
+        const int velocity{obstacles.velocity[i]};
+        size_t j{i};
+        for (; j > 0 and obstacles.col[j - 1] > col; j -= 1)
+        {
+            obstacles.row[j] = obstacles.row[j - 1];
+            obstacles.col[j] = obstacles.col[j - 1];
+            obstacles.velocity[j] = obstacles.velocity[j - 1];
+        }
+        obstacles.row[j] = row;
+        obstacles.col[j] = col;
+        obstacles.velocity[j] = velocity;
+    }
+}
 
-    char currentChar{};
-    string currentCommand;
+//same as moveClouds but for the obstacles, which aren't destroyed but reused at the right side of the screen once they have fully left it.
+//Finding the ones that left is a vectorisable pass that writes a mask into the frame arena. Reusing them draws random numbers, which has to happen one at a time and in order, so that pass only runs when the mask found something
+auto moveObstacles(world &game) -> void
+{
+    SCOPED_SPAN("moveObstacles");
+    obstaclefield &obstacles{game.obstacles};
+    int *col{obstacles.col.data()};
+    int *velocity{obstacles.velocity.data()};
+    const size_t count{obstacles.count};
+    span<unsigned char> offScreen{arenaAllocate<unsigned char>(game.scratch, count)};
 
-    bool allowBackgroundProcessing{true};
+    size_t leaving{0};
+    for (size_t ob = 0; ob < offScreen.size(); ob += 1)
+    {
+        offScreen[ob] = col[ob] + CACTUS_SPRITE.width <= 1; //the last column of the cactus is blank, so it is gone once only that column is left
+        leaving += offScreen[ob];
+    }
+    for (size_t ob = 0; leaving > 0 and ob < offScreen.size(); ob += 1)
+    {
+        if (offScreen[ob] and game.endless)
+        {
+            col[ob] = OBSTACLE_PARKED; //endless mode brings obstacles in from its chunks instead, so the slot waits for one of those
+            velocity[ob] = 0;
+            leaving -= 1;
+        }
+        else if (offScreen[ob])
+        {
+            col[ob] = game.screenLength;
+            velocity[ob] = randomFrom(obvelocity, game.generator);
+            leaving -= 1;
+        }
+    }
+    for (size_t ob = 0; ob < count; ob += 1)
+    {
+        col[ob] -= velocity[ob];
+    }
+    sortObstacles(obstacles);
+}
+
+//changes the players current row and column to follow that of a parabola for realistic movement
+auto jumpPlayer(world &game) -> void
+{
+    //Calculates the vertical component of the player as a quadratic, providing realistic movement. 
+    //t represents the "independent variable" it can be thought of as "frames" of an animation
+    int &t{game.t};
+    player &player{game.playercharacter};
+    t += 1;
+    if (t <= 6) //once the jump animation begins, it can not be stopped until t = 0 again this both stops players from jumping through the sky and ensures the jump cant be cancelled early
+    {
+        player.position.row = (game.screenWidth - 1) - (-pow((t - 3), 2) + 9); //This was the function for the parabola
+        player.position.col += 2;
+    }
+    else
+    {
+        t = 0;
+    }
+}
+//A jump can start from the ground, or on the tick the player lands since jumpPlayer lets the next jump start straight away
+auto canJump(const world &game) -> bool
+{
+    return game.t == 0 or game.t >= 6;
+}
+//Same as drawClouds, but obviously a lot shorter as it only has 1 possible visual state it can be in, and only 1 row
+auto drawPlayer(framebuffer &screen, const player &player) -> void
+{
+    blitSprite(screen, PLAYER_SPRITE, player.position);
+}
+//The ground is drawn at the start but isn't touched again as it doesn't move
+auto drawGround(framebuffer &screen, const ground &ground) -> void
+{
+    for (int i = 0; i < screen.cols; i++)
+    {
+        putText(screen, ground.position.row, ground.position.col + i, "‾", COLOUR_BLACK, true);
+    }
+}
+
+//This function positions the scoreboard at the top center and colors it red.
+auto drawScore(framebuffer &screen, position scoreposition, unsigned int ticks, unsigned int score) -> void
+{
+    char text[64];
+    snprintf(text, sizeof(text), "Score: %u Time: %us", score, ticks / 10);
+    putText(screen, scoreposition.row, scoreposition.col, text, COLOUR_BRIGHT_RED, true);
+}
+
+//Fixes the end position so that the command line does not appear after the scoreboard (ruining the visuals). It goes on the end of the last frame, which is also when the colours are turned off
+auto endPosition(framebuffer &screen) -> void
+{
+    encodeReset(screen.encoder);
+    encodeMove(screen.encoder, screen.rows, screen.cols/2);
+}
+
+//True when a solid cell of one sprite is on top of a solid cell of the other. Only the rows they share are looked at, and each of those is one shift and one AND of their masks.
+//The second sprite is given by its masks alone so a swept version of them (see sweptMasks) can be used instead
+auto spritesOverlap(span<const uint64_t> first, position firstAt, span<const uint64_t> second, position secondAt) -> bool
+{
+    const int offset{secondAt.col - firstAt.col}; //how far right of the first sprite the second one starts
+    if (offset >= 64 or offset <= -64)
+    {
+        return false; //both sprites are narrower than this, so they can't reach each other
+    }
+    uint64_t touching{0};
+    const int top{max(firstAt.row, secondAt.row)};
+    const int bottom{min(firstAt.row + static_cast<int>(first.size()), secondAt.row + static_cast<int>(second.size()))};
+    for (int row = top; row < bottom; row += 1)
+    {
+        const uint64_t mine{first[static_cast<size_t>(row - firstAt.row)]};
+        const uint64_t theirs{second[static_cast<size_t>(row - secondAt.row)]};
+        //both ways round are worked out and one is picked, which is cheaper than guessing wrong about which side the other sprite is on
+        const uint64_t fromLeft{mine & (theirs << (offset & 63))};
+        const uint64_t fromRight{(mine << (-offset & 63)) & theirs};
+        touching |= offset >= 0 ? fromLeft : fromRight;
+    }
+    return touching != 0;
+}
+
+//Function will ensure no solid cell of the player is touching a solid cell of the obstacle, using the shapes the sprites are drawn with. If one is, this function signals that the game is over.
+//A player on the ground after the tick, whether it was there already or just landed, is hit by every column the obstacle passed over during its last move, not just the ones it ended up on, so a fast obstacle can't skip straight through the player
+auto checkCollision(world &game, size_t ob) -> bool
+{
+    const player &character{game.playercharacter};
+    const position obstacleAt{game.obstacles.row[ob], game.obstacles.col[ob]};
+    const bool grounded{character.position.row >= (game.screenWidth - 3)};
+    const int sweep{grounded ? game.obstacles.velocity[ob] : 0};
+    const bool hit{spritesOverlap(PLAYER_SPRITE.masks, character.position, CACTUS_SWEPT_MASKS[static_cast<size_t>(sweep)], obstacleAt)};
+    const int obstacleRight{obstacleAt.col + CACTUS_SPRITE.width - 1};
+    if (not grounded and obstacleRight >= character.position.col + PLAYER_SCORING_LEFT and obstacleRight < character.position.col + PLAYER_SPRITE.width) //If the back of the obstacle is under the front of the player while it is in the air, 1 score is added
+    {
+        game.score += 1;
+    }
+    return hit;
+}
+
+//The obstacles are kept sorted by column, so a binary search finds the few that are close enough to reach the player's columns and only those get checked
+auto checkCollisions(world &game) -> bool
+{
+    SCOPED_SPAN("checkCollisions");
+    const obstaclefield &obstacles{game.obstacles};
+    const player &character{game.playercharacter};
+    const int reach{CACTUS_SPRITE.width - 1 + static_cast<int>(OBSTACLE_FASTEST)}; //how far left of an obstacle's column it can still touch, counting its last move
+    const auto cols{obstacles.col.begin()};
+    size_t ob{static_cast<size_t>(lower_bound(cols, cols + obstacles.count, character.position.col - reach) - cols)};
+    bool gameOver{false};
+    for (; ob < obstacles.count and obstacles.col[ob] < character.position.col + PLAYER_SPRITE.width; ob += 1)
+    {
+        gameOver = checkCollision(game, ob) or gameOver;
+    }
+    return gameOver;
+}
+
+//This function prints some creative ascii art when the game ends
+auto gameOverScreen(framebuffer &screen, unsigned int ticks, unsigned int score) -> void{
+    const position art{screen.rows/2 - 13, screen.cols/2 - 19};
+    blitSprite(screen, GAME_OVER_SPRITE, art);
+    drawScore(screen, {art.row + static_cast<int>(GAME_OVER_SPRITE.rows.size()) - 1, art.col + GAME_OVER_SPRITE.width}, ticks, score);
+}
+
+//if the right side of the player touches the side of the screen, the function signals that the process for a win should begin
+auto checkWon(const world &game) -> bool{
+    bool gameWon = false;
+
+    if(game.level != nullptr){
+        gameWon = game.camera + game.playercharacter.position.col >= game.level->length; //a level is won at its end, not at the edge of the screen
+    }
+    else if(not game.endless and game.playercharacter.position.col >= game.screenLength-8){
+        gameWon = true;
+    }
+
+    return gameWon; 
+}
+
+//Marks the states that get the player hit by a cactus at col, moving left by velocity every tick from tick on. Each t is one shift of its JUMP_HITS mask, which covers every
+//number of ticks in the air at once. Returns the tick the cactus is reused at the right edge
+auto markPath(autopilot &pilot, int start, int col, int velocity, int tick) -> int
+{
+    array<array<uint64_t, 2>, JUMP_PHASES> hits{};
+    array<size_t, JUMP_PHASES> touching{}; //the t that can be hit at all, which is only the ones near the ground
+    size_t touchingCount{0};
+    for (size_t t = 0; t < JUMP_PHASES; t += 1)
+    {
+        const bool grounded{JUMP_ARC[t] <= 2}; //the same rows checkCollision counts as the ground, which is standing and the tick of landing
+        hits[t] = JUMP_HITS[grounded ? static_cast<size_t>(velocity) : 0][t]; //only a player on the ground after the tick is swept over, see checkCollision
+        touching[touchingCount] = t;
+        touchingCount += (hits[t][0] | hits[t][1]) != 0 ? 1 : 0;
+    }
+    for (; tick <= AUTOPILOT_HORIZON and col + CACTUS_SPRITE.width > 1; tick += 1)
+    {
+        col -= velocity;
+        if (col - start > tick * 2 + PLAYER_SPRITE.width or col - start < -JUMP_HIT_BIAS)
+        {
+            continue; //further ahead than the player can have got to yet, or already behind where it started
+        }
+        const int biased{col - start + JUMP_HIT_BIAS};
+        const int shift{63 - biased / 2};
+        const uint64_t inTime{(uint64_t{2} << tick) - 1}; //the player can't have been in the air for longer than it has been
+        for (size_t phase = 0; phase < touchingCount; phase += 1)
+        {
+            const size_t t{touching[phase]};
+            const uint64_t mask{hits[t][static_cast<size_t>(biased & 1)]};
+            pilot.blocked[tick][t] |= (mask >> shift) & inTime;
+        }
+    }
+    return tick;
+}
+
+//Marks which states of the next AUTOPILOT_HORIZON ticks get the player hit. An obstacle only ever moves left by its velocity until it is reused, so where each one will be is
+//known exactly. A reused one comes back at the right edge at a random velocity, so every velocity it could have is marked, once for all the ones reused on the same tick.
+//That is the cactus a player near the edge lands on
+auto markBlocked(autopilot &pilot, const world &game) -> void
+{
+    memset(pilot.blocked, 0, sizeof(pilot.blocked));
+    const obstaclefield &obstacles{game.obstacles};
+    const int start{game.playercharacter.position.col};
+    uint64_t reuses{0}; //bit n for the obstacles reused at tick n
+    for (size_t ob = 0; ob < obstacles.count and obstacles.col[ob] != OBSTACLE_PARKED; ob += 1)
+    {
+        const int reused{markPath(pilot, start, obstacles.col[ob], obstacles.velocity[ob], 1)};
+        reuses |= reused <= AUTOPILOT_HORIZON ? uint64_t{1} << reused : 0;
+    }
+    if (game.endless or game.level != nullptr)
+    {
+        return; //their slots are filled from the level instead, which only ever brings obstacles in at the right edge where they can be seen coming
+    }
+    for (; reuses != 0; reuses &= reuses - 1)
+    {
+        for (int velocity = static_cast<int>(obvelocity.min()); velocity <= static_cast<int>(obvelocity.max()); velocity += 1)
+        {
+            markPath(pilot, start, game.screenLength, velocity, countr_zero(reuses));
+        }
+    }
+}
+
+//Plays the next AUTOPILOT_HORIZON ticks every way the player could jump at once, after jumping (or not) right now. Each t has a mask of the air counts still alive, the same
+//moves stepPlayer makes take them on a tick, and the blocked ones are dropped. Says the last tick anything was alive, or more than AUTOPILOT_HORIZON for a win (the sooner the more)
+auto planAhead(const autopilot &pilot, int t, bool jump) -> int
+{
+    const size_t landed{JUMP_PHASES - 1};
+    array<uint64_t, JUMP_PHASES> alive{};
+    alive[static_cast<size_t>(t)] = 1;
+    for (int tick = 1; tick <= AUTOPILOT_HORIZON; tick += 1)
+    {
+        const uint64_t grounded{alive[0] | alive[landed]};
+        for (size_t phase = landed; phase > 1; phase -= 1) //a jump that is going carries on
+        {
+            alive[phase] = alive[phase - 1] << 1;
+        }
+        alive[1] = (tick > 1 or jump ? grounded : 0) << 1; //jumps, straight away even on the tick it landed
+        alive[0] = tick > 1 or not jump ? grounded : 0;    //stays on the ground, where a jump that landed stops
+        uint64_t anywhere{0};
+        for (size_t phase = 0; phase < JUMP_PHASES; phase += 1)
+        {
+            alive[phase] &= ~pilot.blocked[tick][phase];
+            anywhere |= alive[phase];
+        }
+        if ((anywhere & pilot.winning) != 0)
+        {
+            return AUTOPILOT_HORIZON * 2 + 1 - tick;
+        }
+        if (anywhere == 0)
+        {
+            return tick - 1;
+        }
+    }
+    return AUTOPILOT_HORIZON;
+}
+
+//--autopilot's key for this tick. It jumps only when that stays alive further ahead than staying on the ground, or wins sooner, so it waits for obstacles instead of
+//jumping into ones it can't see yet. Most ticks it is in the air and has nothing to decide
+auto autopilotInput(autopilot &pilot, const world &game) -> char
+{
+    if (not canJump(game))
+    {
+        return NULL_CHAR;
+    }
+    SCOPED_SPAN("autopilotInput");
+    markBlocked(pilot, game);
+    const int winningCol{game.screenLength - 8}; //the same edge checkWon uses
+    const int airToWin{max((winningCol - game.playercharacter.position.col + 1) / 2, 0)};
+    pilot.winning = game.endless or game.level != nullptr or airToWin > AUTOPILOT_HORIZON ? 0 : ~uint64_t{0} << airToWin;
+    return planAhead(pilot, game.t, true) > planAhead(pilot, game.t, false) ? JUMP_CHAR : NULL_CHAR;
+}
+
+//Some more awesome ascii art 
+auto gameWonScreen(framebuffer &screen, unsigned int ticks, unsigned int score) -> void{
+    const position art{screen.rows/2 -15, screen.cols/2 -36};
+    blitSprite(screen, GAME_WON_SPRITE, art);
+    drawScore(screen, {art.row + static_cast<int>(GAME_WON_SPRITE.rows.size()), art.col}, ticks, score);
+}
+
+//Makes chunk number index of an endless level out of a few patterns: a gap, one cactus, two cacti close together at the same speed, or a layer of clouds. It only depends on
+//the level's seed and the index, so the level worker and the tick thread make exactly the same chunk and a replay gets the same level. Later chunks have faster obstacles
+auto generateChunk(levelchunk &chunk, uint64_t seed, uint64_t index) -> void
+{
+    default_random_engine generator{static_cast<default_random_engine::result_type>(batchSeed(seed, index))};
+    const unsigned int fastest{min(3 + static_cast<unsigned int>(min<uint64_t>(index, OBSTACLE_FASTEST) / 2), OBSTACLE_FASTEST)};
+    uniform_int_distribution<unsigned int> obstacleVelocity(2, fastest);
+    uniform_int_distribution<unsigned int> pattern(0, 3);
+    chunk.index = index;
+    chunk.count = 0;
+    auto add{[&chunk](unsigned int tick, unsigned char kind, int velocity, int height)
+             {
+                 if (tick < CHUNK_TICKS and chunk.count < CHUNK_SPAWNS)
+                 {
+                     chunk.spawns[chunk.count] = {.tick = static_cast<uint8_t>(tick), .kind = kind, .velocity = static_cast<uint8_t>(velocity), .height = static_cast<uint16_t>(height)};
+                     chunk.count += 1;
+                 }
+             }};
+    unsigned int tick{index == 0 ? CHUNK_LEAD_IN : 0};
+    while (tick < CHUNK_TICKS)
+    {
+        const unsigned int next{pattern(generator)};
+        if (next == 0)
+        {
+            tick += static_cast<unsigned int>(randomBetween(generator, 8, 20));
+        }
+        else if (next == 1)
+        {
+            add(tick, SPAWN_OBSTACLE, randomFrom(obstacleVelocity, generator), 0);
+            tick += static_cast<unsigned int>(randomBetween(generator, 6, 14));
+        }
+        else if (next == 2)
+        {
+            const int velocity{randomFrom(obstacleVelocity, generator)};
+            add(tick, SPAWN_OBSTACLE, velocity, 0);
+            add(tick + 3, SPAWN_OBSTACLE, velocity, 0);
+            tick += static_cast<unsigned int>(randomBetween(generator, 12, 18));
+        }
+        else
+        {
+            //clouds don't get in the way, so the next pattern starts at the same tick
+            const int height{randomBetween(generator, 0, 1000)};
+            const int clouds{randomBetween(generator, 2, 4)};
+            for (int cloud = 0; cloud < clouds; cloud += 1)
+            {
+                add(tick + static_cast<unsigned int>(cloud) * 2, SPAWN_CLOUD, randomFrom(cloudvelocity, generator), clamp(height + randomBetween(generator, -150, 150), 0, 1000));
+            }
+        }
+    }
+    sort(chunk.spawns, chunk.spawns + chunk.count, [](const chunkspawn &a, const chunkspawn &b) { return a.tick < b.tick; });
+}
+
+//Moves an endless game on to chunk index. The level worker has almost always made it already, and if it hasn't the chunk is made right here instead of waiting for it, which
+//costs this tick a few microseconds rather than a stall
+auto startChunk(world &game, uint64_t index) -> void
+{
+    levelstream *levels{game.levels};
+    if (levels != nullptr and levels->made.load(memory_order_acquire) > index)
+    {
+        game.chunk = levels->slots[index % CHUNK_SLOTS];
+    }
+    else
+    {
+        generateChunk(game.chunk, game.levelSeed, index);
+        if (levels != nullptr)
+        {
+            logNumber(LOG_WARN, "Level worker was behind, made this chunk on the tick thread", index);
+        }
+    }
+    game.chunkTick = 0;
+    game.chunkNext = 0;
+    if (levels != nullptr)
+    {
+        levels->taken.store(index + 1, memory_order_release);
+        levels->taken.notify_one();
+    }
+}
+
+//Brings in whatever the chunk has for this tick, then moves on a tick. Obstacles take a parked slot and start at the right edge like a recycled one does, and are dropped if every slot is in use
+auto spawnFromChunk(world &game) -> void
+{
+    obstaclefield &obstacles{game.obstacles};
+    for (; game.chunkNext < game.chunk.count and game.chunk.spawns[game.chunkNext].tick == game.chunkTick; game.chunkNext += 1)
+    {
+        const chunkspawn &spawn{game.chunk.spawns[game.chunkNext]};
+        if (spawn.kind == SPAWN_CLOUD)
+        {
+            const int sky{game.screenWidth / 2 + game.screenWidth / 10}; //the same sky spawnCloud uses
+            placeCloud(game.clouds, {spawn.height * sky / 1000, game.screenLength - 1}, spawn.velocity);
+            continue;
+        }
+        const auto cols{obstacles.col.begin()};
+        const size_t parked{static_cast<size_t>(lower_bound(cols, cols + obstacles.count, OBSTACLE_PARKED) - cols)};
+        if (parked < obstacles.count)
+        {
+            obstacles.row[parked] = game.screenWidth - 3;
+            obstacles.col[parked] = game.screenLength;
+            obstacles.velocity[parked] = spawn.velocity;
+            sortObstacles(obstacles);
+        }
+    }
+    game.chunkTick += 1;
+    if (game.chunkTick == CHUNK_TICKS)
+    {
+        startChunk(game, game.chunk.index + 1);
+    }
+}
+
+//Endless mode (and a level) keeps the player a quarter of the way across by moving everything else back instead. The clouds move half as far, since they are further away
+auto followPlayer(world &game) -> void
+{
+    const int shift{max(game.playercharacter.position.col - game.screenLength / 4, 0)};
+    game.cameraShift = shift;
+    game.camera += shift;
+    if (shift == 0)
+    {
+        return;
+    }
+    game.playercharacter.position.col -= shift;
+    for (size_t ob = 0; ob < game.obstacles.count; ob += 1)
+    {
+        game.obstacles.col[ob] -= game.obstacles.col[ob] == OBSTACLE_PARKED ? 0 : shift;
+    }
+    for (size_t cloud = 0; cloud < game.clouds.count; cloud += 1)
+    {
+        game.clouds.col[cloud] -= shift / 2;
+    }
+}
+
+//The level worker thread. It keeps the ring full with the chunks after the one being played, and sleeps until the tick thread takes one. If the tick thread had to make a
+//chunk itself, the worker skips ahead to the ones it hasn't got to yet
+auto makeLevels(levelstream &levels) -> void
+{
+    while (levels.running.load(memory_order_acquire))
+    {
+        const uint64_t taken{levels.taken.load(memory_order_acquire)};
+        const uint64_t next{max(levels.made.load(memory_order_relaxed), taken)};
+        if (next - taken >= CHUNK_SLOTS)
+        {
+            levels.taken.wait(taken, memory_order_acquire);
+            continue;
+        }
+        generateChunk(levels.slots[next % CHUNK_SLOTS], levels.seed, next);
+        levels.made.store(next + 1, memory_order_release);
+    }
+}
+
+auto startLevels(levelstream &levels, world &game) -> void
+{
+    levels.seed = game.levelSeed;
+    levels.made.store(game.chunk.index + 1, memory_order_relaxed);
+    levels.taken.store(game.chunk.index + 1, memory_order_relaxed);
+    game.levels = &levels;
+    levels.worker = thread{makeLevels, ref(levels)};
+}
+
+auto stopLevels(levelstream &levels) -> void
+{
+    if (not levels.worker.joinable())
+    {
+        return;
+    }
+    levels.running.store(false, memory_order_release);
+    levels.taken.fetch_add(1, memory_order_release); //the game is over, so taking a chunk that will never be played is just a way to wake the worker
+    levels.taken.notify_one();
+    levels.worker.join();
+}
+
+//Maps a level file for --level. Only the header is read and checked, the kernel pages the rest in as the camera gets to it, so opening a level takes the same time whatever
+//its size. The mapping is kept until the program exits, every mode plays the level right up until it returns
+auto openLevel(levelfile &level, const string &path) -> bool
+{
+    const int fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (fd < 0)
+    {
+        cerr << "Can't open level [" << path << "]" << endl;
+        return false;
+    }
+    struct stat info{};
+    const bool big{fstat(fd, &info) == 0 and static_cast<size_t>(info.st_size) >= sizeof(levelheader)};
+    const size_t size{big ? static_cast<size_t>(info.st_size) : 0};
+    void *mapping{big ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED};
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        cerr << "[" << path << "] is not a level" << endl;
+        return false;
+    }
+    const byte *data{static_cast<const byte *>(mapping)};
+    levelheader header{};
+    memcpy(&header, data, sizeof(header));
+    //each section has to be inside the file, and its index has to be the right size for it, but the entities aren't looked at so a huge level isn't read through here
+    auto section{[&](const levelsection &from, span<const levelentity> &entities, span<const int32_t> &index) -> bool
+                 {
+                     if (from.offset % alignof(levelentity) != 0 or from.offset > size or from.count > (size - from.offset) / sizeof(levelentity) or
+                         from.indexOffset % alignof(int32_t) != 0 or from.indexOffset > size or from.indexCount > (size - from.indexOffset) / sizeof(int32_t) or
+                         from.indexCount != (from.count + LEVEL_INDEX_STRIDE - 1) / LEVEL_INDEX_STRIDE)
+                     {
+                         return false;
+                     }
+                     entities = {reinterpret_cast<const levelentity *>(data + from.offset), from.count};
+                     index = {reinterpret_cast<const int32_t *>(data + from.indexOffset), from.indexCount};
+                     return true;
+                 }};
+    if (not equal(begin(LEVEL_MAGIC), end(LEVEL_MAGIC), header.magic) or header.length <= 0 or not section(header.obstacles, level.obstacles, level.obstacleIndex) or
+        not section(header.scenery, level.scenery, level.sceneryIndex))
+    {
+        cerr << "[" << path << "] is not a level" << endl;
+        munmap(mapping, size);
+        return false;
+    }
+    level.length = header.length;
+    return true;
+}
+
+//The entities with a column from low up to but not including high. They are sorted by column so they are all next to each other: a binary search of the sparse index finds the
+//block the first one is in and a short look through that block finds it, which only touches a few cache lines of the index and one page of the entities however long the level is
+auto queryLevel(span<const levelentity> entities, span<const int32_t> index, int64_t low, int64_t high) -> span<const levelentity>
+{
+    auto firstFrom{[&](int64_t col) -> size_t
+                   {
+                       const size_t block{static_cast<size_t>(lower_bound(index.begin(), index.end(), col) - index.begin())};
+                       size_t first{block == 0 ? 0 : (block - 1) * LEVEL_INDEX_STRIDE};
+                       while (first < entities.size() and entities[first].col < col)
+                       {
+                           first += 1;
+                       }
+                       return first;
+                   }};
+    const size_t first{firstFrom(low)};
+    const size_t last{max(firstFrom(high), first)};
+    return entities.subspan(first, last - first);
+}
+
+//How many obstacle slots a level needs on a screen this wide: one for every column the camera can see an obstacle in, since a level can put one in each
+auto levelCapacity(int screenLength) -> size_t
+{
+    return static_cast<size_t>(screenLength + CACTUS_SPRITE.width + static_cast<int>(OBSTACLE_FASTEST) + 1);
+}
+
+//Puts what the camera can see of the level into the obstacles and clouds, replacing what was there. The work only depends on how much is on the screen, never on how long the level is.
+//Obstacles further left than the player can be are kept for the collision check. The clouds are half as far along the level as the camera, since they are further away
+auto viewLevel(world &game) -> void
+{
+    SCOPED_SPAN("viewLevel");
+    const levelfile &level{*game.level};
+    obstaclefield &obstacles{game.obstacles};
+    const int64_t reach{CACTUS_SPRITE.width + static_cast<int>(OBSTACLE_FASTEST)};
+    size_t count{0};
+    for (const levelentity &entity : queryLevel(level.obstacles, level.obstacleIndex, game.camera - reach, game.camera + game.screenLength + 1))
+    {
+        if (count == obstacles.col.size())
+        {
+            break;
+        }
+        obstacles.row[count] = game.screenWidth - 3;
+        obstacles.col[count] = static_cast<int>(entity.col - game.camera);
+        obstacles.velocity[count] = LEVEL_SCROLL;
+        count += 1;
+    }
+    obstacles.count = count;
+
+    const int64_t sky{game.camera / 2};
+    const int skyRows{game.screenWidth / 2 + game.screenWidth / 10}; //the same sky spawnCloud uses
+    game.clouds.count = 0;
+    for (const levelentity &entity : queryLevel(level.scenery, level.sceneryIndex, sky - CLOUD_SPRITE.width, sky + game.screenLength))
+    {
+        placeCloud(game.clouds, {entity.height * skyRows / 1000, static_cast<int>(entity.col - sky)}, LEVEL_SCROLL / 2);
+    }
+}
+
+//Puts a fresh game into the world for its screenWidth and screenLength. The generator carries on from wherever it is, so seed it first for a game that can be played again
+auto setupWorld(world &game, unsigned int obstacleCount, unsigned int extraClouds) -> void
+{
+    uniform_int_distribution<unsigned int> cloudgenerator(3, 8);
+    const int screenWidth{game.screenWidth};
+    const int screenLength{game.screenLength};
+    game.t = 0;
+    game.score = 0;
+    game.ticks = 0;
+    game.scoreposition = {1, (screenLength / 2) - 18}; //set the position to the top center. The -18 is to center the text, otherwise the left side of the text would start at the middle
+    game.playercharacter = player{.position = {(screenWidth - 1), 0}};
+    game.ground = ground{.position = {(screenWidth), 0}}; //sets ground position to the bottom of the screen
+
+    //At most one cloud is made per tick, and even the slowest cloud is gone once it has crossed the screen, so this many slots can never run out
+    const size_t cloudCapacity{static_cast<size_t>(screenLength + CLOUD_SPRITE.width) + cloudgenerator.max() + 1 + extraClouds};
+    resetClouds(game.clouds, cloudCapacity);
+    //a level from a file has everything in it already, and starts at its beginning
+    if (game.level != nullptr)
+    {
+        const size_t slots{levelCapacity(screenLength)};
+        game.obstacles.row.resize(slots);
+        game.obstacles.col.resize(slots);
+        game.obstacles.velocity.resize(slots);
+        game.camera = 0;
+        viewLevel(game);
+        return;
+    }
+    //an endless level keeps a slot for every obstacle that could be on the screen at once. They come in at most one a tick and take at least half as many ticks as there are columns to cross
+    if (game.endless)
+    {
+        obstacleCount = max(obstacleCount, static_cast<unsigned int>(screenLength / 2 + 2));
+    }
+    //the most the arena is asked for is the sort below, or one byte per obstacle for moveObstacles
+    resetArena(game.scratch, obstacleCount * sizeof(position) + alignof(position));
+
+    //generate anywhere from 3 to 8 clouds at the beginning, plus any extra ones asked for to load up the simulation
+    for (unsigned int clouditerator = 0; clouditerator <= cloudgenerator(game.generator); clouditerator++)
+    {
+        spawnCloud(game, false);
+    }
+    for (unsigned int clouditerator = 0; clouditerator < extraClouds; clouditerator++)
+    {
+        spawnCloud(game, false);
+    }
+
+    if (game.endless)
+    {
+        game.levelSeed = game.generator();
+        game.obstacles.row.assign(obstacleCount, screenWidth - 3);
+        game.obstacles.col.assign(obstacleCount, OBSTACLE_PARKED);
+        game.obstacles.velocity.assign(obstacleCount, 0);
+        game.obstacles.count = obstacleCount;
+        startChunk(game, 0);
+        return;
+    }
+
+    //these start in no order at all, which is the one time insertion sort would be slow, so they are sorted as (col, velocity) pairs in the arena first
+    span<position> unsorted{arenaAllocate<position>(game.scratch, obstacleCount)};
+    for (position &ob : unsorted)
+    {
+        ob.col = randomBetween(game.generator, 100, screenLength);
+        ob.row = randomFrom(obvelocity, game.generator); //not a row, this is just a pair to sort
+    }
+    sort(unsorted.begin(), unsorted.end(), [](const position &a, const position &b) { return a.col < b.col; });
+    game.obstacles.row.assign(obstacleCount, screenWidth - 3);
+    game.obstacles.col.resize(obstacleCount);
+    game.obstacles.velocity.resize(obstacleCount);
+    game.obstacles.count = obstacleCount;
+    for (size_t ob = 0; ob < unsorted.size(); ob += 1)
+    {
+        game.obstacles.col[ob] = unsorted[ob].col;
+        game.obstacles.velocity[ob] = unsorted[ob].row;
+    }
+    game.scratch.used = 0;
+}
+
+//Moves a game that is being played onto a screen of a new size without starting it again. The player, ground and obstacles stay on the bottom of the screen, the clouds stay in the sky,
+//and the right edge (where obstacles come back and the player wins) moves with the width. The play area never gets smaller than the game needs, a smaller terminal just clips it
+auto resizeWorld(world &game, int rows, int cols) -> void
+{
+    rows = max(rows, SCREEN_MIN_ROWS);
+    cols = max(cols, SCREEN_MIN_COLS);
+    const int drop{rows - game.screenWidth};
+    game.playercharacter.position.row += drop;
+    game.ground.position.row += drop;
+    for (size_t ob = 0; ob < game.obstacles.count; ob += 1)
+    {
+        game.obstacles.row[ob] += drop;
+    }
+    //a wider sky can have that many more clouds on it at once (see setupWorld), and growing keeps the ones already there
+    if (cols > game.screenLength)
+    {
+        const size_t cloudCapacity{game.clouds.row.size() + static_cast<size_t>(cols - game.screenLength)};
+        game.clouds.row.resize(cloudCapacity);
+        game.clouds.col.resize(cloudCapacity);
+        game.clouds.velocity.resize(cloudCapacity);
+        game.clouds.alive.resize(cloudCapacity);
+    }
+    //and an endless level needs a slot for each of the obstacles that can now be on the screen at once, which are parked until a chunk brings them in
+    const size_t obstacleCapacity{static_cast<size_t>(cols / 2 + 2)};
+    if (game.endless and obstacleCapacity > game.obstacles.count)
+    {
+        game.obstacles.row.resize(obstacleCapacity, rows - 3);
+        game.obstacles.col.resize(obstacleCapacity, OBSTACLE_PARKED);
+        game.obstacles.velocity.resize(obstacleCapacity, 0);
+        game.obstacles.count = obstacleCapacity;
+        resetArena(game.scratch, obstacleCapacity * sizeof(position) + alignof(position));
+    }
+    //a level fills its slots again from the file every tick, so they only need to be there for next time
+    if (game.level != nullptr and levelCapacity(cols) > game.obstacles.col.size())
+    {
+        game.obstacles.row.resize(levelCapacity(cols));
+        game.obstacles.col.resize(levelCapacity(cols));
+        game.obstacles.velocity.resize(levelCapacity(cols));
+    }
+    game.screenWidth = rows;
+    game.screenLength = cols;
+    game.scoreposition = {1, (cols / 2) - 18};
+}
+
+//Moves everything but the player on by a tick. A race moves its course once a tick for all of its players, see stepRace
+auto stepCourse(world &game) -> void
+{
+    uniform_int_distribution<unsigned int> chanceOfCloud(1, 10);
+    game.ticks++;
+    game.scratch.used = 0;
+
+    if (game.level != nullptr)
+    {
+        game.camera += LEVEL_SCROLL;
+        viewLevel(game);
+    }
+    else
+    {
+        moveClouds(game.clouds);
+        moveObstacles(game);
+    }
+    if (game.endless)
+    {
+        spawnFromChunk(game);
+    }
+
+    //This block generates a new cloud with a 1/10 chance every tick (0.1s) This means there should be a cloud roughly every second. Endless mode has its clouds in its chunks, and a level has them in its file
+    if (not game.endless and game.level == nullptr and chanceOfCloud(game.generator) == 1)
+    {
+        spawnCloud(game, true);
+    }
+}
+
+//Moves the player on by a tick once the course has moved, and says how the game is going for them
+auto stepPlayer(world &game, char currentChar) -> unsigned short
+{
+    //make character jump
+    if (currentChar == JUMP_CHAR or game.t > 0)
+    {
+        jumpPlayer(game); 
+
+        if (currentChar == JUMP_CHAR and game.t == 0)
+        {
+            jumpPlayer(game); //Can jump immediately after touching the ground by calling it again
+        }
+    }
+
+    if (game.endless or game.level != nullptr)
+    {
+        followPlayer(game);
+    }
+
+    //each iteration the game checks if the player is colliding with the obstacles
+    if (checkCollisions(game))
+    {
+        return GAME_LOST;
+    }
+    if (checkWon(game))
+    {
+        return GAME_WON;
+    }
+    return GAME_RUNNING;
+}
+
+//The "actual" game, one tick of it without any drawing. Everything moves first so that the collision check afterwards sees exactly what is about to be drawn
+auto stepWorld(world &game, char currentChar) -> unsigned short
+{
+    SCOPED_SPAN("stepWorld");
+    stepCourse(game);
+    return stepPlayer(game, currentChar);
+}
+
+//FNV-1a over everything that affects how the game plays out, used by traces to check that a replay hasn't gone differently
+auto hashWorld(const world &game) -> uint64_t
+{
+    uint64_t hash{14695981039346656037ull};
+    auto mix{[&hash](int64_t value)
+             {
+                 for (int byte = 0; byte < 8; byte += 1)
+                 {
+                     hash = (hash ^ ((value >> (byte * 8)) & 0xFF)) * 1099511628211ull;
+                 }
+             }};
+    mix(game.ticks);
+    mix(game.t);
+    mix(game.score);
+    mix(game.playercharacter.position.row);
+    mix(game.playercharacter.position.col);
+    if (game.endless)
+    {
+        mix(static_cast<int64_t>(game.chunk.index));
+        mix(game.chunkTick);
+    }
+    mix(game.camera);
+    for (size_t ob = 0; ob < game.obstacles.count; ob += 1)
+    {
+        mix(game.obstacles.col[ob]);
+        mix(game.obstacles.velocity[ob]);
+    }
+    for (size_t cloud = 0; cloud < game.clouds.count; cloud += 1)
+    {
+        mix(game.clouds.row[cloud]);
+        mix(game.clouds.col[cloud]);
+        mix(game.clouds.velocity[cloud]);
+    }
+    return hash;
+}
+
+auto openTrace(tracewriter &trace, const string &path, traceheader header) -> bool
+{
+    copy(begin(TRACE_MAGIC), end(TRACE_MAGIC), header.magic);
+    trace.file.open(path, ios::binary | ios::trunc);
+    trace.file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    return trace.file.good();
+}
+
+auto writeTraceRecord(tracewriter &trace, uint32_t tick, unsigned char kind, uint64_t value) -> void
+{
+    if (not trace.file.is_open())
+    {
+        return;
+    }
+    trace.file.write(reinterpret_cast<const char *>(&tick), sizeof(tick));
+    trace.file.put(static_cast<char>(kind));
+    if (kind == TRACE_HASH or kind == TRACE_RESIZE)
+    {
+        trace.file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+    else
+    {
+        trace.file.put(static_cast<char>(value));
+    }
+}
+
+//Called after every tick of a recorded game with the input that tick used
+auto traceTick(tracewriter &trace, const world &game, char currentChar) -> void
+{
+    SCOPED_SPAN("traceTick");
+    if (currentChar != NULL_CHAR and currentChar != EMPTY_CHAR)
+    {
+        writeTraceRecord(trace, game.ticks, TRACE_INPUT, static_cast<unsigned char>(currentChar));
+    }
+    if (game.ticks % TRACE_HASH_INTERVAL == 0)
+    {
+        writeTraceRecord(trace, game.ticks, TRACE_HASH, hashWorld(game));
+    }
+}
+
+//Draws the world part way between the tick before and the newest one. Everything but the player moves a whole velocity (and whatever the camera moved) every tick, so only the player needs to know where it was
+auto drawWorld(framebuffer &screen, const world &game, position playerBefore, double behind) -> void
+{
+    SCOPED_SPAN("drawWorld");
+    const position playerAfter{game.playercharacter.position};
+    const position playerAt{playerAfter.row + static_cast<int>(lround((playerBefore.row - playerAfter.row) * behind)),
+                            playerAfter.col + static_cast<int>(lround((playerBefore.col - playerAfter.col) * behind))};
+    drawGround(screen, game.ground);
+    drawPlayer(screen, player{.position = playerAt});
+    drawClouds(screen, game.clouds, behind, game.cameraShift);
+    drawObstacles(screen, game.obstacles, behind, game.cameraShift);
+    drawScore(screen, game.scoreposition, game.ticks, game.score);
+}
+
+//Feeds one byte from the terminal through the decoder. Returns true with the event filled in when the byte finished a key. Sequences are ESC [ or ESC O, then any number of
+//parameter bytes, then a final byte that says what the key was. Escape followed by anything else (alt and a key) isn't used by the game, so it is just reported as unknown
+auto decodeKey(keydecoder &decoder, char byte, chrono::steady_clock::time_point now, inputevent &event) -> bool
+{
+    event = {.kind = KEY_TEXT, .key = byte, .time = now};
+    if (decoder.state == DECODE_TEXT)
+    {
+        if (byte == '\033')
+        {
+            decoder.state = DECODE_ESCAPE;
+            return false;
+        }
+        return true;
+    }
+    if (decoder.state == DECODE_ESCAPE)
+    {
+        if (byte == '[' or byte == 'O')
+        {
+            decoder.state = DECODE_SEQUENCE;
+            return false;
+        }
+        decoder.state = DECODE_TEXT;
+        event.kind = KEY_UNKNOWN;
+        return true;
+    }
+    if (byte >= 0x20 and byte < 0x40) //parameters like the 1;5 in ESC [ 1 ; 5 A, which is control and up
+    {
+        return false;
+    }
+    decoder.state = DECODE_TEXT;
+    event.kind = byte == 'A' ? KEY_UP : byte == 'B' ? KEY_DOWN : byte == 'C' ? KEY_RIGHT : byte == 'D' ? KEY_LEFT : KEY_UNKNOWN;
+    return true;
+}
+
+//Both the space bar and the up arrow jump
+auto isJump(const inputevent &event) -> bool
+{
+    return event.kind == KEY_UP or (event.kind == KEY_TEXT and event.key == JUMP_CHAR);
+}
+
+//Adds a key for the simulation thread. Returns false when the queue is full, which only happens if ticks have stopped being taken
+auto pushInput(inputqueue &queue, inputevent event) -> bool
+{
+    const size_t tail{queue.tail.load(memory_order_relaxed)};
+    if (tail - queue.head.load(memory_order_acquire) == INPUT_QUEUE_SLOTS)
+    {
+        return false;
+    }
+    queue.events[tail & (INPUT_QUEUE_SLOTS - 1)] = event;
+    queue.tail.store(tail + 1, memory_order_release);
+    return true;
+}
+
+auto popInput(inputqueue &queue, inputevent &event) -> bool
+{
+    const size_t head{queue.head.load(memory_order_relaxed)};
+    if (head == queue.tail.load(memory_order_acquire))
+    {
+        return false;
+    }
+    event = queue.events[head & (INPUT_QUEUE_SLOTS - 1)];
+    queue.head.store(head + 1, memory_order_release);
+    return true;
+}
+
+//The input thread. It sleeps until a key arrives (or the game is over), takes everything the terminal has sent in one read, and passes every key on with the time it came in,
+//so reading the keyboard never waits on a tick or on the terminal and keys pressed close together all get through
+auto readInput(pipeline &pipe) -> void
+{
+    pollfd sources[]{{.fd = 0, .events = POLLIN, .revents = 0}, {.fd = pipe.wake, .events = POLLIN, .revents = 0}};
     bool showCommandline{false};
+    string currentCommand;
+    keydecoder decoder{};
+    char keys[256];
+    while (pipe.running.load(memory_order_acquire))
+    {
+        //only wait a moment when an escape came in on its own, since that is either the start of a sequence whose rest is on its way or the escape key
+        const int timeout{decoder.state == DECODE_TEXT ? -1 : static_cast<int>(ESCAPE_TIMEOUT.count())};
+        const int ready{poll(sources, 2, timeout)};
+        if (ready < 0 or (sources[1].revents & POLLIN) != 0)
+        {
+            continue; // interrupted by a signal, or woken up to check running again
+        }
+        if (ready == 0)
+        {
+            pushInput(pipe.input, {.kind = decoder.state == DECODE_ESCAPE ? KEY_ESCAPE : KEY_UNKNOWN, .key = '\033', .time = chrono::steady_clock::now()});
+            decoder.state = DECODE_TEXT;
+            continue;
+        }
+        if ((sources[0].revents & (POLLIN | POLLHUP)) == 0)
+        {
+            continue;
+        }
+        SCOPED_SPAN("input");
+        const ssize_t count{read(0, keys, sizeof(keys))};
+        const auto now{chrono::steady_clock::now()};
+        if (count == 0)
+        {
+            sources[0].fd = -1; // stdin was closed, so stop waking up for it
+        }
+        for (ssize_t key = 0; key < count; key += 1)
+        {
+            inputevent event{};
+            if (not decodeKey(decoder, keys[key], now, event))
+            {
+                continue;
+            }
+            // Depending on the mode, either pass each key on or collect a whole command
+            if (showCommandline and event.kind == KEY_TEXT)
+            {
+                if (event.key != '\n')
+                {
+                    currentCommand += event.key;
+                    continue;
+                }
+                logText(LOG_INFO, "Received command", currentCommand);
+                currentCommand.clear();
+                continue;
+            }
+            if (not pushInput(pipe.input, event))
+            {
+                logText(LOG_WARN, "Input queue is full, dropped a key", string_view{&keys[key], 1});
+            }
+            if (event.kind == KEY_TEXT and event.key == QUIT_CHAR)
+            {
+                return;
+            }
+        }
+    }
+}
+
+//The simulation thread. Ticks come from the timer alone, so a terminal that is slow to take output can't hold them up. Each tick takes the keys that arrived since the last one
+//(the last key counts, like it did when one key was read per tick), steps the world and hands a copy of it to the renderer. Quitting or the end of the game stops everything
+auto simulate(pipeline &pipe, world &game, tracewriter &trace, int tickMilliseconds, bool autopiloted) -> void
+{
+    int tickTimer{createTickTimer(tickMilliseconds)};
+    pollfd timer{.fd = tickTimer, .events = POLLIN, .revents = 0};
+    unsigned int back{0};
+    auto startTimestamp{chrono::steady_clock::now()};
+    auto allocationsLastTick{heapAllocations.load()}; // a steady game should show 0 allocations for every tick after the first
+    unsigned int resizesSeen{terminalResizes.load(memory_order_relaxed)};
+    bool jumpPending{false};
+    chrono::steady_clock::time_point jumpPressed{};
+    autopilot pilot{};
+    while (true)
+    {
+        if (poll(&timer, 1, -1) < 0)
+        {
+            continue; // interrupted by a signal, just wait again
+        }
+        uint64_t expirations;
+        read(tickTimer, &expirations, sizeof(expirations)); // only needed to re-arm the readiness, a late tick is not run twice
+        SCOPED_SPAN("tick");
+
+        char currentChar{NULL_CHAR};
+        inputevent event{};
+        while (popInput(pipe.input, event) and currentChar != QUIT_CHAR)
+        {
+            //every key that came in since the last tick is looked at, so a jump still counts when another key was pressed after it
+            if (isJump(event))
+            {
+                jumpPending = true;
+                jumpPressed = event.time;
+            }
+            else if (event.kind == KEY_TEXT)
+            {
+                currentChar = event.key;
+            }
+        }
+        if (currentChar == QUIT_CHAR)
+        {
+            writeTraceRecord(trace, game.ticks, TRACE_END, GAME_RUNNING);
+            break;
+        }
+
+        //the terminal was resized since the last tick. Only the size from the kernel is used here, the input thread owns stdin so the terminal can't be asked
+        const unsigned int resizes{terminalResizes.load(memory_order_relaxed)};
+        const position size{resizes != resizesSeen ? windowSize() : position{}};
+        resizesSeen = resizes;
+        if (size.row > 0)
+        {
+            writeTraceRecord(trace, game.ticks, TRACE_RESIZE, (static_cast<uint64_t>(size.row) << 32) | static_cast<uint32_t>(size.col));
+            resizeWorld(game, size.row, size.col);
+            logNumber(LOG_INFO, "Resized to columns", static_cast<uint64_t>(game.screenLength));
+        }
+
+        const auto endTimestamp{chrono::steady_clock::now()};
+        //a jump pressed in the air waits for the player to land, as long as that is soon enough to still feel like the same press
+        jumpPending = jumpPending and endTimestamp - jumpPressed <= JUMP_BUFFER;
+        if (jumpPending and canJump(game))
+        {
+            currentChar = JUMP_CHAR;
+            jumpPending = false;
+            logNumber(LOG_DEBUG, "Jump applied, microseconds after the press", static_cast<uint64_t>(chrono::duration_cast<chrono::microseconds>(endTimestamp - jumpPressed).count()));
+        }
+        if (autopiloted)
+        {
+            currentChar = autopilotInput(pilot, game); //the keys still quit and resize, but the jumping is left to the autopilot
+        }
+        logTick(game.ticks + 1, true, chrono::duration_cast<chrono::milliseconds>(endTimestamp - startTimestamp).count(), currentChar, "", heapAllocations.load() - allocationsLastTick);
+        allocationsLastTick = heapAllocations.load();
+        startTimestamp = endTimestamp;
+
+        const position playerBefore{game.playercharacter.position};
+        auto state{stepWorld(game, currentChar)};
+        traceTick(trace, game, currentChar);
+        if (state != GAME_RUNNING)
+        {
+            writeTraceRecord(trace, game.ticks, TRACE_END, state);
+        }
+
+        //every snapshot was sized in main, so this copy reuses their memory instead of allocating. Only a resize that adds cloud slots makes each of them grow once
+        pipe.frames[back].game = game;
+        pipe.frames[back].playerBefore = playerBefore;
+        pipe.frames[back].time = endTimestamp;
+        pipe.frames[back].state = state;
+        back = pipe.middle.exchange(back | FRAME_FRESH, memory_order_acq_rel) & FRAME_INDEX;
+        if (state != GAME_RUNNING)
+        {
+            break;
+        }
+    }
+    close(tickTimer);
+    pipe.running.store(false, memory_order_release);
+    const uint64_t stop{1};
+    write(pipe.wake, &stop, sizeof(stop));
+}
+
+//The render thread, which is main's own thread. It runs on its own clock, up to 60 frames a second, and each frame takes the newest snapshot if there is one. Frames are drawn a tick
+//behind the simulation, sliding from the tick before towards the newest one, so motion is smooth while the game itself still only changes once a tick. When the terminal can't take
+//that many frames, the time between them grows with the time a frame really takes, but never past a tick. Returns the state the game ended in, after showing the end screen if there is one
+auto renderFrames(pipeline &pipe, framebuffer &screen, outputsink &sink, chrono::milliseconds tickInterval) -> unsigned short
+{
+    unsigned int front{2};
+    unsigned int resizesSeen{terminalResizes.load(memory_order_relaxed)};
+    chrono::nanoseconds interval{RENDER_INTERVAL};
+    chrono::nanoseconds frameCost{0}; //a running average of how long drawing and writing a frame takes
+    auto nextFrame{chrono::steady_clock::now()};
+    while (true)
+    {
+        this_thread::sleep_until(nextFrame);
+        const bool running{pipe.running.load(memory_order_acquire)}; //read before the middle, so a stop always comes after the last snapshot has been seen
+        if ((pipe.middle.load(memory_order_acquire) & FRAME_FRESH) != 0)
+        {
+            front = pipe.middle.exchange(front, memory_order_acq_rel) & FRAME_INDEX;
+        }
+        else if (not running)
+        {
+            //the player quit, so leave the terminal in plain text for whatever comes next
+            screen.encoder.bytes.clear();
+            encodeReset(screen.encoder);
+            writeFrame(sink, screen.encoder.bytes);
+            return GAME_RUNNING;
+        }
+        const snapshot &frame{pipe.frames[front]};
+        const auto started{chrono::steady_clock::now()};
+
+        //the grids always match the real terminal, even when it is smaller than the world and the world is clipped. The terminal has moved its contents around, so start again from a blank one
+        const unsigned int resizes{terminalResizes.load(memory_order_relaxed)};
+        const position size{resizes != resizesSeen ? windowSize() : position{}};
+        resizesSeen = resizes;
+        if (size.row > 0)
+        {
+            resizeFramebuffer(screen, size.row, size.col);
+            if (sink.cast != nullptr)
+            {
+                castResize(*sink.cast, size.row, size.col);
+            }
+        }
+        //the recording lost a frame, and every frame after that only has the cells that changed, so the whole screen is sent again to get it back in step
+        const bool redraw{size.row > 0 or sink.needsKeyframe};
+        if (sink.needsKeyframe)
+        {
+            fill(screen.front.begin(), screen.front.end(), cell{});
+            sink.needsKeyframe = false;
+        }
+
+        clearFramebuffer(screen);
+        if (frame.state == GAME_LOST)
+        {
+            gameOverScreen(screen, frame.game.ticks, frame.game.score);
+        }
+        else if (frame.state == GAME_WON)
+        {
+            gameWonScreen(screen, frame.game.ticks, frame.game.score);
+        }
+        else
+        {
+            const double sinceTick{chrono::duration<double>(started - frame.time) / tickInterval};
+            drawWorld(screen, frame.game, frame.playerBefore, clamp(1.0 - sinceTick, 0.0, 1.0));
+        }
+
+        //everything above only touched the back grid, this is the one write to the terminal for the frame. Once a frame has caught up with the newest tick there is nothing to send
+        presentFramebuffer(screen, redraw);
+        if (frame.state != GAME_RUNNING)
+        {
+            endPosition(screen);
+        }
+        if (not screen.encoder.bytes.empty())
+        {
+            SCOPED_SPAN("flush");
+            writeFrame(sink, screen.encoder.bytes);
+        }
+        if (sink.broadcast != nullptr)
+        {
+            broadcastKeyframe(*sink.broadcast, screen, started);
+        }
+        if (frame.state != GAME_RUNNING)
+        {
+            return frame.state;
+        }
+
+        //a terminal that is slow to take output makes the write above block, which shows up here as frames that take longer
+        const auto finished{chrono::steady_clock::now()};
+        frameCost += (finished - started - frameCost) / 8;
+        interval = clamp(chrono::nanoseconds{frameCost * 2}, RENDER_INTERVAL, chrono::nanoseconds{tickInterval});
+        nextFrame = max(nextFrame + interval, finished);
+    }
+}
+
+//A simple policy for the batch runner: stay on the ground until the next obstacle ahead is about to reach the front of the player, then jump over it
+auto botInput(const world &game) -> char
+{
+    if (not canJump(game))
+    {
+        return NULL_CHAR;
+    }
+    const obstaclefield &obstacles{game.obstacles};
+    const int front{game.playercharacter.position.col + PLAYER_SPRITE.width - 1};
+    const auto cols{obstacles.col.begin()};
+    const size_t next{static_cast<size_t>(upper_bound(cols, cols + obstacles.count, front) - cols)};
+    if (next == obstacles.count)
+    {
+        return NULL_CHAR;
+    }
+    return obstacles.col[next] - front <= BOT_JUMP_GAP * obstacles.velocity[next] ? JUMP_CHAR : NULL_CHAR;
+}
+
+//Plays one game of a batch to the end in the worker's own world, with the autopilot or the script if there is one and the bot otherwise
+auto playBatchGame(const settings &options, world &game, autopilot &pilot, uint64_t index, batchstats &stats) -> void
+{
+    game.generator.seed(batchSeed(options.seed, index));
+    setupWorld(game, options.obstacles, options.clouds);
+    size_t scriptPosition{0};
+    unsigned short state{GAME_RUNNING};
+    while (state == GAME_RUNNING and game.ticks < BATCH_TICK_LIMIT)
+    {
+        char currentChar{NULL_CHAR};
+        if (options.autopilot)
+        {
+            currentChar = autopilotInput(pilot, game);
+        }
+        else if (options.script.empty())
+        {
+            currentChar = botInput(game);
+        }
+        else
+        {
+            currentChar = options.script[scriptPosition];
+            scriptPosition = (scriptPosition + 1) % options.script.size();
+        }
+        state = stepWorld(game, currentChar);
+    }
+    stats.ticks += game.ticks;
+    if (state == GAME_RUNNING)
+    {
+        stats.outOfTime += 1;
+        return;
+    }
+    stats.scores[min<size_t>(game.score, BATCH_SCORE_BUCKETS - 1)] += 1;
+    if (state == GAME_WON)
+    {
+        stats.won += 1;
+        return;
+    }
+    stats.lost += 1;
+    stats.deaths[min<size_t>(game.ticks / 10, BATCH_TIME_BUCKETS - 1)] += 1;
+}
+
+//Takes up to BATCH_CHUNK games off the front of a worker's own range
+auto takeGames(batchrange &range, uint64_t &first, uint64_t &last) -> bool
+{
+    uint64_t bounds{range.bounds.load(memory_order_acquire)};
+    while (true)
+    {
+        const uint64_t begin{bounds >> 32};
+        const uint64_t end{bounds & BATCH_RANGE_END};
+        if (begin >= end)
+        {
+            return false;
+        }
+        const uint64_t taken{min(end, begin + BATCH_CHUNK)};
+        if (range.bounds.compare_exchange_weak(bounds, (taken << 32) | end, memory_order_acq_rel))
+        {
+            first = begin;
+            last = taken;
+            return true;
+        }
+    }
+}
+
+//Takes the back half of another worker's range. A single game left is left alone, its owner is about to play it anyway
+auto stealGames(batchrange &range, uint64_t &first, uint64_t &last) -> bool
+{
+    uint64_t bounds{range.bounds.load(memory_order_acquire)};
+    while (true)
+    {
+        const uint64_t begin{bounds >> 32};
+        const uint64_t end{bounds & BATCH_RANGE_END};
+        if (end < begin + 2)
+        {
+            return false;
+        }
+        const uint64_t middle{begin + (end - begin) / 2};
+        if (range.bounds.compare_exchange_weak(bounds, (begin << 32) | middle, memory_order_acq_rel))
+        {
+            first = middle;
+            last = end;
+            return true;
+        }
+    }
+}
+
+//One batch worker. It plays its own range a chunk at a time, and once that is empty steals half of whichever range has the most left. Ranges only ever shrink except
+//when a thief refills its own, so once every range looks empty the only games left are ones a thief has already claimed, and this worker can stop
+auto runBatchWorker(const settings &options, vector<batchrange> &ranges, size_t self, batchstats &stats) -> void
+{
+    world game{.screenWidth = options.rows, .screenLength = options.cols, .endless = options.endless, .level = options.level};
+    autopilot pilot{};
+    uint64_t first{0};
+    uint64_t last{0};
+    while (true)
+    {
+        if (takeGames(ranges[self], first, last))
+        {
+            for (uint64_t index = first; index < last; index += 1)
+            {
+                playBatchGame(options, game, pilot, index, stats);
+            }
+            continue;
+        }
+        bool stolen{false};
+        while (not stolen)
+        {
+            size_t victim{self};
+            uint64_t most{1};
+            for (size_t other = 0; other < ranges.size(); other += 1)
+            {
+                const uint64_t bounds{ranges[other].bounds.load(memory_order_relaxed)};
+                const uint64_t left{(bounds & BATCH_RANGE_END) - min(bounds & BATCH_RANGE_END, bounds >> 32)};
+                if (left > most)
+                {
+                    victim = other;
+                    most = left;
+                }
+            }
+            if (victim == self)
+            {
+                return;
+            }
+            stolen = stealGames(ranges[victim], first, last);
+        }
+        stats.steals += 1;
+        ranges[self].bounds.store((first << 32) | last, memory_order_release);
+    }
+}
+
+//Prints a histogram with a bar for each bucket. The last bucket is everything from its label up
+auto printHistogram(span<const unsigned long long> buckets, const char *unit) -> void
+{
+    const unsigned long long largest{max(*max_element(buckets.begin(), buckets.end()), 1ull)};
+    for (size_t bucket = 0; bucket < buckets.size(); bucket += 1)
+    {
+        char line[128]{};
+        const int bar{static_cast<int>(buckets[bucket] * 50 / largest)};
+        snprintf(line, sizeof(line), "  %3zu%s%-2s |%-50.*s %llu", bucket, bucket + 1 == buckets.size() ? "+" : " ", unit, bar, "##################################################", buckets[bucket]);
+        cout << line << endl;
+    }
+}
+
+//Plays --batch games, each from its own seed, on every core and reports how they went. Every worker has its own world and statistics, the only thing they share is the game ranges
+auto runBatch(const settings &options) -> int
+{
+    const unsigned int threadCount{options.threads > 0 ? options.threads : max(thread::hardware_concurrency(), 1u)};
+    vector<batchrange> ranges(threadCount);
+    vector<batchstats> results(threadCount);
+    for (size_t worker = 0; worker < threadCount; worker += 1)
+    {
+        ranges[worker].bounds.store(((options.batchGames * worker / threadCount) << 32) | (options.batchGames * (worker + 1) / threadCount));
+    }
+
+    auto startTimestamp{chrono::steady_clock::now()};
+    vector<thread> workers{};
+    for (size_t worker = 0; worker < threadCount; worker += 1)
+    {
+        workers.emplace_back(runBatchWorker, cref(options), ref(ranges), worker, ref(results[worker]));
+    }
+    batchstats total{};
+    for (size_t worker = 0; worker < threadCount; worker += 1)
+    {
+        workers[worker].join();
+        const batchstats &stats{results[worker]};
+        total.won += stats.won;
+        total.lost += stats.lost;
+        total.outOfTime += stats.outOfTime;
+        total.ticks += stats.ticks;
+        total.steals += stats.steals;
+        for (size_t bucket = 0; bucket < BATCH_SCORE_BUCKETS; bucket += 1)
+        {
+            total.scores[bucket] += stats.scores[bucket];
+        }
+        for (size_t bucket = 0; bucket < BATCH_TIME_BUCKETS; bucket += 1)
+        {
+            total.deaths[bucket] += stats.deaths[bucket];
+        }
+    }
+    auto seconds{chrono::duration<double>(chrono::steady_clock::now() - startTimestamp).count()};
+
+    const double games{static_cast<double>(max(options.batchGames, 1ull))};
+    cout << "Batch " << options.rows << "x" << options.cols << " seed " << options.seed << ": " << options.batchGames << " games with " << options.obstacles << " obstacles, "
+         << (options.autopilot ? "autopilot" : options.script.empty() ? "bot" : "scripted") << " policy, " << threadCount << " threads in " << seconds << "s ("
+         << static_cast<unsigned long long>(static_cast<double>(options.batchGames) / max(seconds, 1e-9)) << " games/sec, "
+         << static_cast<unsigned long long>(static_cast<double>(total.ticks) / max(seconds, 1e-9)) << " ticks/sec, " << total.steals << " steals)" << endl;
+    cout << "Won " << total.won << " (" << 100 * static_cast<double>(total.won) / games << "%), lost " << total.lost << " (" << 100 * static_cast<double>(total.lost) / games
+         << "%), out of time " << total.outOfTime << endl;
+    cout << "Score at the end of the game:" << endl;
+    printHistogram(total.scores, "");
+    cout << "Seconds played before losing:" << endl;
+    printHistogram(total.deaths, "s");
+    return EXIT_SUCCESS;
+}
+
+//Runs the game without a terminal as fast as it will go, starting a new game every time one ends, and reports how many ticks per second it managed
+auto runHeadless(const settings &options) -> int
+{
+    world game{.screenWidth = options.rows, .screenLength = options.cols, .endless = options.endless, .level = options.level};
+    game.generator.seed(options.seed);
+    setupWorld(game, options.obstacles, options.clouds);
+
+    unsigned long long gamesWon{0};
+    unsigned long long gamesLost{0};
+    size_t scriptPosition{0};
+    autopilot pilot{};
+    const auto allocationsBefore{heapAllocations.load()};
+    auto startTimestamp{chrono::steady_clock::now()};
+    for (unsigned long long tick = 0; tick < options.maxTicks; tick += 1)
+    {
+        char currentChar{NULL_CHAR};
+        if (options.autopilot)
+        {
+            currentChar = autopilotInput(pilot, game);
+        }
+        else if (not options.script.empty())
+        {
+            currentChar = options.script[scriptPosition];
+            scriptPosition = (scriptPosition + 1) % options.script.size();
+        }
+        auto state{stepWorld(game, currentChar)};
+        if (state != GAME_RUNNING)
+        {
+            (state == GAME_WON ? gamesWon : gamesLost) += 1;
+            setupWorld(game, options.obstacles, options.clouds);
+        }
+    }
+    auto seconds{chrono::duration<double>(chrono::steady_clock::now() - startTimestamp).count()};
+    const auto allocations{heapAllocations.load() - allocationsBefore};
 
-    auto startTimestamp{chrono::steady_clock::now()};
-    auto endTimestamp{startTimestamp};
-    int elapsedTimePerTick{100}; // Every 0.1s check on things
-    SetNonblockingReadState(allowBackgroundProcessing);
-    ClearScreen();
-    HideCursor();
+    cout << "Headless " << options.rows << "x" << options.cols << " seed " << options.seed << ": " << options.maxTicks << " ticks in " << seconds << "s ("
+         << static_cast<unsigned long long>(options.maxTicks / max(seconds, 1e-9)) << " ticks/sec), "
+         << gamesWon << " games won, " << gamesLost << " games lost, " << allocations << " heap allocations" << endl;
+    return EXIT_SUCCESS;
+}
+
+//Writes what a policy gets to see of a game: how high the player is and how far through a jump, then the distance from the front of the player to each of the
+//DINOSAUR_NEAREST obstacles that haven't been passed yet and how fast they are coming. Missing obstacles are a screen away and still
+auto observeWorld(const world &game, float *observation) -> void
+{
+    const obstaclefield &obstacles{game.obstacles};
+    const int back{game.playercharacter.position.col};
+    const int front{back + PLAYER_SPRITE.width - 1};
+    observation[0] = static_cast<float>(game.screenWidth - 1 - game.playercharacter.position.row);
+    observation[1] = static_cast<float>(game.t);
+    const auto cols{obstacles.col.begin()};
+    size_t next{static_cast<size_t>(upper_bound(cols, cols + obstacles.count, back - CACTUS_SPRITE.width) - cols)}; //one still under the player hasn't been passed
+    for (int nearest = 0; nearest < DINOSAUR_NEAREST; nearest += 1, next += 1)
+    {
+        const bool there{next < obstacles.count and obstacles.col[next] != OBSTACLE_PARKED};
+        observation[2 + nearest * 2] = static_cast<float>(there ? obstacles.col[next] - front : game.screenLength);
+        observation[3 + nearest * 2] = static_cast<float>(there ? obstacles.velocity[next] : 0);
+    }
+}
+
+//Starts game index of a batch again, from the seed for its next episode
+auto resetEnvGame(dinosaurenv &env, size_t index) -> void
+{
+    world &game{env.games[index]};
+    game.generator.seed(batchSeed(env.seed, env.episodes[index] * env.games.size() + index));
+    env.episodes[index] += 1;
+    setupWorld(game, env.obstacles, 0);
+}
+
+//Resets or steps the games from first to last for the call in env, writing only their own entries of its buffers
+auto runEnvSlice(dinosaurenv &env, size_t first, size_t last) -> void
+{
+    for (size_t index = first; index < last; index += 1)
+    {
+        world &game{env.games[index]};
+        if (env.resetting)
+        {
+            env.episodes[index] = 0;
+            resetEnvGame(env, index);
+        }
+        else
+        {
+            const unsigned int scoreBefore{game.score};
+            const unsigned short state{stepWorld(game, env.actions != nullptr and env.actions[index] != 0 ? JUMP_CHAR : NULL_CHAR)};
+            const bool done{state != GAME_RUNNING or game.ticks >= BATCH_TICK_LIMIT};
+            if (env.rewards != nullptr)
+            {
+                env.rewards[index] = static_cast<float>(game.score - scoreBefore) + (state == GAME_WON ? 1.0f : state == GAME_LOST ? -1.0f : 0.0f);
+            }
+            if (env.dones != nullptr)
+            {
+                env.dones[index] = done ? 1 : 0;
+            }
+            if (done)
+            {
+                resetEnvGame(env, index);
+            }
+        }
+        if (env.observations != nullptr)
+        {
+            observeWorld(game, env.observations + index * DINOSAUR_OBSERVATION_SIZE);
+        }
+    }
+}
+
+//Where slice number slice of the games starts. The calling thread is the last slice and each worker is one of the others
+auto envSliceStart(const dinosaurenv &env, size_t slice) -> size_t
+{
+    return env.games.size() * slice / (env.workers.size() + 1);
+}
+
+//An environment worker thread. It sleeps until a call bumps generation past seen, does its slice and goes back to sleep
+auto runEnvWorker(dinosaurenv &env, size_t slice, uint64_t seen) -> void
+{
+    while (true)
+    {
+        env.generation.wait(seen, memory_order_acquire);
+        seen = env.generation.load(memory_order_acquire);
+        if (not env.running.load(memory_order_acquire))
+        {
+            return;
+        }
+        runEnvSlice(env, envSliceStart(env, slice), envSliceStart(env, slice + 1));
+        if (env.busy.fetch_sub(1, memory_order_release) == 1)
+        {
+            env.busy.notify_one();
+        }
+    }
+}
+
+//Hands a call out to the workers, does the last slice itself and waits for the rest. The workers only look at the call once generation has moved, and the
+//caller only touches the buffers again once busy is back to 0, so neither needs a lock
+auto runEnvCall(dinosaurenv &env) -> void
+{
+    env.busy.store(static_cast<unsigned int>(env.workers.size()), memory_order_relaxed);
+    env.generation.fetch_add(1, memory_order_release);
+    env.generation.notify_all();
+    runEnvSlice(env, envSliceStart(env, env.workers.size()), env.games.size());
+    for (unsigned int left = env.busy.load(memory_order_acquire); left != 0; left = env.busy.load(memory_order_acquire))
+    {
+        env.busy.wait(left, memory_order_acquire);
+    }
+}
+
+extern "C" auto dinosaurCreate(uint32_t games, int32_t rows, int32_t cols, uint32_t obstacles, uint32_t threads) -> dinosaurenv *
+{
+    if (games == 0 or rows < SCREEN_MIN_ROWS or cols < SCREEN_MIN_COLS)
+    {
+        return nullptr;
+    }
+    dinosaurenv *env{new (nothrow) dinosaurenv{}};
+    if (env == nullptr)
+    {
+        return nullptr;
+    }
+    //running out of memory or threads is a batch that can't be made, not an exception thrown into C
+    try
+    {
+        env->games.assign(games, world{.screenWidth = rows, .screenLength = cols});
+        env->episodes.assign(games, 0);
+        env->obstacles = obstacles;
+        dinosaurReset(env, 0, nullptr); //every world gets its arrays here, on this thread before there are any workers, so nothing after this allocates
+        const uint32_t threadCount{min(threads > 0 ? threads : max(thread::hardware_concurrency(), 1u), games)};
+        env->workers.reserve(threadCount - 1);
+        for (size_t slice = 0; slice + 1 < threadCount; slice += 1)
+        {
+            env->workers.emplace_back(runEnvWorker, ref(*env), slice, env->generation.load(memory_order_relaxed));
+        }
+    }
+    catch (const exception &)
+    {
+        dinosaurDestroy(env); //stops whichever workers did start
+        return nullptr;
+    }
+    return env;
+}
+
+extern "C" auto dinosaurReset(dinosaurenv *env, uint64_t seed, float *observations) -> void
+{
+    env->seed = seed;
+    env->resetting = true;
+    env->actions = nullptr;
+    env->observations = observations;
+    env->rewards = nullptr;
+    env->dones = nullptr;
+    runEnvCall(*env);
+}
+
+extern "C" auto dinosaurStep(dinosaurenv *env, const uint8_t *actions, float *observations, float *rewards, uint8_t *dones) -> void
+{
+    env->resetting = false;
+    env->actions = actions;
+    env->observations = observations;
+    env->rewards = rewards;
+    env->dones = dones;
+    runEnvCall(*env);
+}
+
+extern "C" auto dinosaurDestroy(dinosaurenv *env) -> void
+{
+    if (env == nullptr)
+    {
+        return;
+    }
+    env->running.store(false, memory_order_release);
+    env->generation.fetch_add(1, memory_order_release);
+    env->generation.notify_all();
+    for (thread &worker : env->workers)
+    {
+        worker.join();
+    }
+    delete env;
+}
+
+//Makes a level for --make-level: cacti on their own or in pairs, with gaps a jump can clear, and clouds all the way along. Everything is added in column order, so both lists come out sorted
+auto generateLevel(uint64_t seed, int64_t length, vector<levelentity> &obstacles, vector<levelentity> &scenery) -> void
+{
+    default_random_engine generator{static_cast<default_random_engine::result_type>(batchSeed(seed, 0))};
+    for (int64_t col = LEVEL_LEAD_IN; col < length; col += randomBetween(generator, 24, 60))
+    {
+        obstacles.push_back({.col = static_cast<int32_t>(col)});
+        if (randomBetween(generator, 0, 3) == 0)
+        {
+            obstacles.push_back({.col = static_cast<int32_t>(col + CACTUS_SPRITE.width + 1)});
+            col += CACTUS_SPRITE.width + 1;
+        }
+    }
+    for (int64_t col = 0; col < length / 2; col += randomBetween(generator, 8, 40)) //the clouds only go half as far, see viewLevel
+    {
+        scenery.push_back({.col = static_cast<int32_t>(col), .height = randomBetween(generator, 0, 1000)});
+    }
+}
+
+//The sparse index of a section: the column of every LEVEL_INDEX_STRIDE'th entity
+auto buildIndex(span<const levelentity> entities) -> vector<int32_t>
+{
+    vector<int32_t> index{};
+    for (size_t entity = 0; entity < entities.size(); entity += LEVEL_INDEX_STRIDE)
+    {
+        index.push_back(entities[entity].col);
+    }
+    return index;
+}
+
+//Writes a level file: the header, then each section's entities followed by its index
+auto writeLevel(const string &path, int64_t length, span<const levelentity> obstacles, span<const levelentity> scenery) -> bool
+{
+    const vector<int32_t> obstacleIndex{buildIndex(obstacles)};
+    const vector<int32_t> sceneryIndex{buildIndex(scenery)};
+    levelheader header{.length = length};
+    copy(begin(LEVEL_MAGIC), end(LEVEL_MAGIC), header.magic);
+    uint64_t offset{sizeof(header)};
+    auto place{[&offset](levelsection &section, size_t count, size_t indexCount)
+               {
+                   section = {.offset = offset, .count = count, .indexOffset = offset + count * sizeof(levelentity), .indexCount = indexCount};
+                   offset = (section.indexOffset + indexCount * sizeof(int32_t) + alignof(levelentity) - 1) / alignof(levelentity) * alignof(levelentity);
+               }};
+    place(header.obstacles, obstacles.size(), obstacleIndex.size());
+    place(header.scenery, scenery.size(), sceneryIndex.size());
+
+    ofstream file{path, ios::binary | ios::trunc};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    auto section{[&file](span<const levelentity> entities, const vector<int32_t> &index)
+                 {
+                     file.write(reinterpret_cast<const char *>(entities.data()), static_cast<streamsize>(entities.size_bytes()));
+                     file.write(reinterpret_cast<const char *>(index.data()), static_cast<streamsize>(index.size() * sizeof(int32_t)));
+                     while (file.tellp() % static_cast<streamoff>(alignof(levelentity)) != 0)
+                     {
+                         file.put(0);
+                     }
+                 }};
+    section(obstacles, obstacleIndex);
+    section(scenery, sceneryIndex);
+    return file.good();
+}
+
+//Makes a level as long as --level-length and writes it to the file given to --make-level
+auto runMakeLevel(const settings &options) -> int
+{
+    const int64_t length{clamp<int64_t>(options.levelLength, 1, INT32_MAX / 2)}; //columns are 32 bits, with room left for the last obstacles
+    vector<levelentity> obstacles{};
+    vector<levelentity> scenery{};
+    generateLevel(options.seed, length, obstacles, scenery);
+    if (not writeLevel(options.makeLevelPath, length, obstacles, scenery))
+    {
+        cerr << "Error writing level [" << options.makeLevelPath << "]" << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "Level " << options.makeLevelPath << " seed " << options.seed << ": " << length << " columns, " << obstacles.size() << " obstacles, " << scenery.size() << " clouds" << endl;
+    return EXIT_SUCCESS;
+}
+
+//Writes state as the changes from base: how many fields there are, then for every 8 fields a byte with a bit for each one that changed followed by how much each of those changed as a
+//zigzag varint. Fields past the end of base count as 0, so a delta from nothing is a whole snapshot. Most of a race stays put or moves a few columns a tick, so most fields cost
+//a bit and the rest a byte
+auto encodeDelta(span<const int32_t> state, span<const int32_t> base, string &out) -> void
+{
+    auto varint{[&out](uint32_t value)
+                {
+                    for (; value >= 0x80; value >>= 7)
+                    {
+                        out += static_cast<char>(value | 0x80);
+                    }
+                    out += static_cast<char>(value);
+                }};
+    varint(static_cast<uint32_t>(state.size()));
+    for (size_t group = 0; group < state.size(); group += 8)
+    {
+        const size_t mask{out.size()};
+        out += '\0';
+        for (size_t field = group; field < min(group + 8, state.size()); field += 1)
+        {
+            const uint32_t change{static_cast<uint32_t>(state[field]) - static_cast<uint32_t>(field < base.size() ? base[field] : 0)};
+            if (change != 0)
+            {
+                out[mask] = static_cast<char>(out[mask] | (1 << (field - group)));
+                varint((change << 1) ^ (0u - (change >> 31)));
+            }
+        }
+    }
+}
+
+//Undoes encodeDelta. Returns false for anything that isn't a whole delta, since a client that gets one of those has nothing it can draw
+auto decodeDelta(string_view bytes, span<const int32_t> base, vector<int32_t> &state) -> bool
+{
+    size_t at{0};
+    auto varint{[&](uint32_t &value) -> bool
+                {
+                    value = 0;
+                    for (int shift = 0; shift < 35 and at < bytes.size(); shift += 7)
+                    {
+                        const auto next{static_cast<uint8_t>(bytes[at])};
+                        at += 1;
+                        value |= static_cast<uint32_t>(next & 0x7f) << shift;
+                        if ((next & 0x80) == 0)
+                        {
+                            return true;
+                        }
+                    }
+                    return false;
+                }};
+    uint32_t count{0};
+    if (not varint(count) or count > bytes.size() * 8) //every field takes at least a bit
+    {
+        return false;
+    }
+    state.resize(count);
+    for (size_t group = 0; group < count; group += 8)
+    {
+        if (at == bytes.size())
+        {
+            return false;
+        }
+        const auto mask{static_cast<uint8_t>(bytes[at])};
+        at += 1;
+        for (size_t field = group; field < min<size_t>(group + 8, count); field += 1)
+        {
+            uint32_t change{0};
+            if ((mask >> (field - group)) & 1 and not varint(change))
+            {
+                return false;
+            }
+            state[field] = static_cast<int32_t>(static_cast<uint32_t>(field < base.size() ? base[field] : 0) + ((change >> 1) ^ (0u - (change & 1))));
+        }
+    }
+    return at == bytes.size();
+}
+
+//Flattens a race into the numbers a snapshot is made of, laid out as RACE_FIELDS says. Things keep their place from one tick to the next, so a field mostly changes by a little
+auto packRace(const world &game, uint64_t race, span<const racer> racers, vector<int32_t> &state) -> void
+{
+    const obstaclefield &obstacles{game.obstacles};
+    const cloudfield &clouds{game.clouds};
+    state.clear();
+    state.insert(state.end(), {static_cast<int32_t>(race), static_cast<int32_t>(game.ticks), game.screenWidth, game.screenLength, static_cast<int32_t>(racers.size()),
+                               static_cast<int32_t>(obstacles.count), static_cast<int32_t>(clouds.count)});
+    for (const racer &racer : racers)
+    {
+        state.insert(state.end(), {racer.state, racer.playercharacter.position.row, racer.playercharacter.position.col, racer.t, static_cast<int32_t>(racer.score)});
+    }
+    for (size_t ob = 0; ob < obstacles.count; ob += 1)
+    {
+        state.insert(state.end(), {obstacles.row[ob], obstacles.col[ob], obstacles.velocity[ob]});
+    }
+    for (size_t cloud = 0; cloud < clouds.count; cloud += 1)
+    {
+        state.insert(state.end(), {clouds.row[cloud], clouds.col[cloud]});
+    }
+}
+
+//Undoes packRace into a world for drawing or for the bot, and the racers. Returns false when the numbers don't add up
+auto unpackRace(span<const int32_t> state, world &view, vector<racer> &racers) -> bool
+{
+    if (state.size() < RACE_FIELDS or state[2] < SCREEN_MIN_ROWS or state[3] < SCREEN_MIN_COLS or state[4] < 0 or state[5] < 0 or state[6] < 0 or
+        state.size() != RACE_FIELDS + RACER_FIELDS * static_cast<size_t>(state[4]) + OBSTACLE_FIELDS * static_cast<size_t>(state[5]) + CLOUD_FIELDS * static_cast<size_t>(state[6]))
+    {
+        return false;
+    }
+    view.ticks = static_cast<unsigned int>(state[1]);
+    view.screenWidth = state[2];
+    view.screenLength = state[3];
+    view.ground.position = {view.screenWidth, 0};
+    view.scoreposition = {1, view.screenLength / 2 - 18};
+    size_t at{RACE_FIELDS};
+    racers.resize(static_cast<size_t>(state[4]));
+    for (racer &racer : racers)
+    {
+        racer.state = static_cast<unsigned short>(state[at]);
+        racer.playercharacter.position = {state[at + 1], state[at + 2]};
+        racer.t = state[at + 3];
+        racer.score = static_cast<unsigned int>(state[at + 4]);
+        at += RACER_FIELDS;
+    }
+    obstaclefield &obstacles{view.obstacles};
+    obstacles.count = static_cast<size_t>(state[5]);
+    obstacles.row.resize(max(obstacles.row.size(), obstacles.count));
+    obstacles.col.resize(obstacles.row.size());
+    obstacles.velocity.resize(obstacles.row.size());
+    for (size_t ob = 0; ob < obstacles.count; ob += 1, at += OBSTACLE_FIELDS)
+    {
+        obstacles.row[ob] = state[at];
+        obstacles.col[ob] = state[at + 1];
+        obstacles.velocity[ob] = state[at + 2];
+    }
+    view.clouds.count = 0;
+    if (view.clouds.row.size() < static_cast<size_t>(state[6]))
+    {
+        resetClouds(view.clouds, static_cast<size_t>(state[6]));
+    }
+    for (int cloud = 0; cloud < state[6]; cloud += 1, at += CLOUD_FIELDS)
+    {
+        placeCloud(view.clouds, {state[at], state[at + 1]}, 0);
+    }
+    return true;
+}
+
+//One tick of a race: the course moves once for everyone, then each racer still running takes its turn in the world. The first to the finish wins the race for everyone,
+//and the race is over once nobody is still running. A jump a client sent waits for the racer to be able to jump, for as long as the terminal game would keep it
+auto stepRace(world &game, span<racer> racers, chrono::steady_clock::time_point now) -> bool
+{
+    SCOPED_SPAN("stepRace");
+    stepCourse(game);
+    bool won{false};
+    bool running{false};
+    for (racer &racer : racers)
+    {
+        if (racer.state != GAME_RUNNING)
+        {
+            continue;
+        }
+        game.playercharacter = racer.playercharacter;
+        game.t = racer.t;
+        game.score = racer.score;
+        racer.jumpWaiting = racer.jumpWaiting and now - racer.jumpPressed <= JUMP_BUFFER;
+        const bool jumping{racer.jumpWaiting and canJump(game)};
+        racer.jumpWaiting = racer.jumpWaiting and not jumping;
+        racer.state = stepPlayer(game, jumping ? JUMP_CHAR : NULL_CHAR);
+        racer.playercharacter = game.playercharacter;
+        racer.t = game.t;
+        racer.score = game.score;
+        won = won or racer.state == GAME_WON;
+        running = running or racer.state == GAME_RUNNING;
+    }
+    for (racer &racer : racers)
+    {
+        racer.state = won and racer.state == GAME_RUNNING ? GAME_LOST : racer.state;
+    }
+    return won or not running;
+}
+
+//Opens a unix socket at path, to listen on or to connect to
+auto openSocket(const string &path, bool listening) -> int
+{
+    sockaddr_un address{.sun_family = AF_UNIX, .sun_path = {}};
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        cerr << "The socket path [" << path << "] is too long" << endl;
+        return -1;
+    }
+    copy(path.begin(), path.end(), address.sun_path);
+    const int fd{socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | (listening ? SOCK_NONBLOCK : 0), 0)};
+    if (listening)
+    {
+        unlink(path.c_str()); //a server that was stopped with ctrl-c leaves its socket behind
+    }
+    const bool opened{fd >= 0 and (listening ? bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0 and listen(fd, static_cast<int>(NET_MAX_PLAYERS)) == 0
+                                             : connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0)};
+    if (not opened)
+    {
+        cerr << "Can't " << (listening ? "serve on" : "join") << " [" << path << "]: " << strerror(errno) << endl;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+//The race server for --serve. One world is the course everyone races on and each client has a racer in it. Every tick the course moves once, each racer has its turn, and the
+//race is packed up and sent to every client as a delta against the newest snapshot that client has acknowledged. Clients that acknowledged the same snapshot are sent the same
+//bytes, so each distinct delta is only made once, and a client whose socket is full just misses a snapshot and gets a bigger delta later. It runs for --ticks ticks
+auto runServer(const settings &options) -> int
+{
+    const int listener{openSocket(options.servePath, true)};
+    if (listener < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    const int tickMilliseconds{100};
+    const int timer{createTickTimer(tickMilliseconds)};
+    world game{.screenWidth = options.rows, .screenLength = options.cols};
+    vector<racer> racers(NET_MAX_PLAYERS);
+    size_t slots{0}; //racers past this have never been used, and aren't sent
+    array<vector<int32_t>, NET_HISTORY> history{}; //the snapshot of frame f is in history[f % NET_HISTORY]
+    array<string, NET_HISTORY + 1> encoded{};      //this frame's message made from each baseline, the last one is the whole snapshot
+    array<uint32_t, NET_HISTORY + 1> encodedFrame{};
+    array<pollfd, NET_MAX_PLAYERS + 2> sources{};
+    for (vector<int32_t> &state : history)
+    {
+        state.reserve(NET_MESSAGE_BYTES / sizeof(int32_t));
+    }
+    for (string &message : encoded)
+    {
+        message.reserve(NET_MESSAGE_BYTES);
+    }
+
+    uint32_t frame{0};
+    uint64_t race{0};
+    bool racing{false};
+    unsigned int pause{0};
+    unsigned long long missed{0};
+    unsigned long long sent{0};
+    unsigned long long sentBytes{0};
+    unsigned long long wholeSnapshots{0};
+    unsigned long long encodings{0};
+    unsigned long long dropped{0};
+    size_t mostRacers{0};
+    chrono::nanoseconds busiest{0};
+    chrono::nanoseconds busy{0};
+    cout << "Serving races on " << options.servePath << " for " << options.maxTicks << " ticks" << endl;
+    while (frame < options.maxTicks)
+    {
+        sources[0] = {.fd = timer, .events = POLLIN, .revents = 0};
+        sources[1] = {.fd = listener, .events = POLLIN, .revents = 0};
+        for (size_t slot = 0; slot < NET_MAX_PLAYERS; slot += 1)
+        {
+            sources[slot + 2] = {.fd = racers[slot].fd, .events = POLLIN, .revents = 0};
+        }
+        if (poll(sources.data(), sources.size(), -1) < 0)
+        {
+            continue; // interrupted by a signal
+        }
+
+        //new clients watch until the next race starts. Past NET_MAX_PLAYERS they are hung up on straight away
+        for (int client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC); client >= 0; client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC))
+        {
+            const auto empty{find_if(racers.begin(), racers.end(), [](const racer &racer) { return racer.state == RACER_EMPTY; })};
+            if (empty == racers.end())
+            {
+                close(client);
+                continue;
+            }
+            const auto slot{static_cast<uint32_t>(empty - racers.begin())};
+            *empty = racer{.fd = client, .state = RACER_WATCHING};
+            slots = max(slots, static_cast<size_t>(slot) + 1);
+            const netmessage welcome{.kind = NET_WELCOME, .frame = slot};
+            send(client, &welcome, sizeof(welcome), MSG_NOSIGNAL);
+            logNumber(LOG_INFO, "Racer joined", slot);
+        }
+
+        const auto now{chrono::steady_clock::now()};
+        for (size_t slot = 0; slot < slots; slot += 1)
+        {
+            racer &racer{racers[slot]};
+            if (racer.fd < 0 or (sources[slot + 2].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+            {
+                continue;
+            }
+            netmessage message{};
+            ssize_t received{0};
+            while ((received = recv(racer.fd, &message, sizeof(message), 0)) == sizeof(message))
+            {
+                if (message.kind == NET_INPUT and message.key == JUMP_CHAR)
+                {
+                    racer.jumpWaiting = true;
+                    racer.jumpPressed = now;
+                }
+                else if (message.kind == NET_ACK and message.frame <= frame)
+                {
+                    racer.acked = max(racer.acked, message.frame);
+                }
+            }
+            if (received == 0 or (received < 0 and errno != EAGAIN))
+            {
+                close(racer.fd);
+                racer = {};
+                logNumber(LOG_INFO, "Racer left", slot);
+            }
+        }
+
+        uint64_t expirations{0};
+        if ((sources[0].revents & POLLIN) == 0 or read(timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+        {
+            continue;
+        }
+        if (expirations > 1)
+        {
+            missed += expirations - 1;
+            logNumber(LOG_WARN, "Server missed ticks", expirations - 1);
+        }
+        frame += 1;
+
+        //the tick itself: a race starts once the last one has had its pause and somebody is there to race, and everyone connected is in it
+        const span<racer> playing{racers.data(), slots};
+        const size_t connected{static_cast<size_t>(count_if(playing.begin(), playing.end(), [](const racer &racer) { return racer.fd >= 0; }))};
+        mostRacers = max(mostRacers, connected);
+        pause -= pause > 0 ? 1 : 0;
+        if (not racing and pause == 0 and connected > 0)
+        {
+            race += 1;
+            game.generator.seed(batchSeed(options.seed, race));
+            setupWorld(game, options.obstacles, options.clouds);
+            for (racer &racer : playing)
+            {
+                racer.state = racer.fd >= 0 ? GAME_RUNNING : RACER_EMPTY;
+                racer.playercharacter = game.playercharacter;
+                racer.t = 0;
+                racer.score = 0;
+                racer.jumpWaiting = false;
+            }
+            racing = true;
+        }
+        if (racing and stepRace(game, playing, now))
+        {
+            racing = false;
+            pause = RACE_PAUSE;
+            logNumber(LOG_INFO, "Race over", race);
+        }
+
+        vector<int32_t> &state{history[frame % NET_HISTORY]};
+        packRace(game, race, playing, state);
+        for (racer &racer : playing)
+        {
+            if (racer.fd < 0)
+            {
+                continue;
+            }
+            const uint32_t base{racer.acked != 0 and frame - racer.acked < NET_HISTORY ? racer.acked : 0};
+            const size_t cached{base == 0 ? NET_HISTORY : base % NET_HISTORY};
+            string &message{encoded[cached]};
+            if (encodedFrame[cached] != frame)
+            {
+                message.clear();
+                message += static_cast<char>(NET_SNAPSHOT);
+                message.append(reinterpret_cast<const char *>(&frame), sizeof(frame));
+                message.append(reinterpret_cast<const char *>(&base), sizeof(base));
+                encodeDelta(state, base == 0 ? span<const int32_t>{} : span<const int32_t>{history[cached]}, message);
+                encodedFrame[cached] = frame;
+                encodings += 1;
+            }
+            if (message.size() > NET_MESSAGE_BYTES or send(racer.fd, message.data(), message.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+            {
+                dropped += 1;
+                continue;
+            }
+            sent += 1;
+            sentBytes += message.size();
+            wholeSnapshots += base == 0 ? 1 : 0;
+        }
+        const auto took{chrono::steady_clock::now() - now};
+        busy += took;
+        busiest = max(busiest, chrono::duration_cast<chrono::nanoseconds>(took));
+    }
+
+    for (racer &racer : racers)
+    {
+        if (racer.fd >= 0)
+        {
+            close(racer.fd);
+        }
+    }
+    close(listener);
+    close(timer);
+    unlink(options.servePath.c_str());
+    cout << "Served " << frame << " ticks, " << race << " races, up to " << mostRacers << " racers: " << sent << " snapshots of "
+         << static_cast<double>(sentBytes) / static_cast<double>(max(sent, 1ull)) << " bytes (" << wholeSnapshots << " whole), " << encodings << " encoded, " << dropped << " dropped" << endl;
+    cout << "Ticks took " << chrono::duration<double, micro>(busy).count() / max(frame, 1u) << "us on average and " << chrono::duration<double, micro>(busiest).count()
+         << "us at most, " << missed << " missed" << endl;
+    return EXIT_SUCCESS;
+}
 
-    while (currentChar != QUIT_CHAR)
-    {
-        // if(currentChar == BLOCKING_CHAR || currentChar == JUMP_CHAR || currentChar == EMPTY_CHAR){
-        //     //A whole lotta nothin'
-        // }
-        
-        // else
-        // {
-            //------------------------------------------------------------------------------------------------------------------------!MAGIC!-------------------------------------------------------------------------------------------------------------------------
-            endTimestamp = chrono::steady_clock::now();
-            auto elapsed{chrono::duration_cast<chrono::milliseconds>(endTimestamp - startTimestamp).count()};
-            // We want to process input and update the world when EITHER
-            // (a) there is background processing and enough time has elapsed
-            // (b) when we are not allowing background processing.
-            if (
-                (allowBackgroundProcessing and (elapsed >= elapsedTimePerTick)) or (not allowBackgroundProcessing))
-            {
-                ticks++;
-                cerr << "Ticks [" << ticks << "] allowBackgroundProcessing [" << allowBackgroundProcessing << "] elapsed [" << elapsed << "] currentChar [" << currentChar << "] currentCommand [" << currentCommand << "]" << endl;
-                // if (currentChar == BLOCKING_CHAR) // Toggle background processing      
-                // {
-
-                //     else{
-                //         allowBackgroundProcessing = not allowBackgroundProcessing;
-                //         SetNonblockingReadState(allowBackgroundProcessing);
-                //     }
-
-                // }
-                //------------------------------------------------------------------------------------------------------------------------!MAGIC!-------------------------------------------------------------------------------------------------------------------------
-                ClearScreen();
-                // The "actual" game. Draws the characters, and sets up new variables for the next ieration of the while loop.
-                
-                //make character jump
-                if (currentChar == JUMP_CHAR or t > 0)
+//A client for --join. Every snapshot is decoded against the one it was made from, acknowledged straight away and drawn: this client's racer as the player and everyone else in
+//magenta. In the terminal the keyboard jumps, and a headless client (for loading up a server) has the bot play instead. It stops when the server goes, on q, or after --ticks snapshots
+auto runClient(const settings &options) -> int
+{
+    const int server{openSocket(options.joinPath, false)};
+    if (server < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    const bool terminal{not options.headless};
+    if (terminal)
+    {
+        SetupScreenAndInput();
+        SetNonblockingReadState(true);
+        ClearScreen();
+        HideCursor();
+    }
+    array<vector<int32_t>, NET_HISTORY> history{};
+    array<uint32_t, NET_HISTORY> historyFrame{};
+    vector<int32_t> decoded{};
+    vector<racer> racers{};
+    world view{};
+    autopilot pilot{};
+    framebuffer screen{};
+    outputsink sink{terminal ? openOutput(options.outputPath) : outputsink{.kind = OUTPUT_NULL}};
+    keydecoder decoder{};
+    string message(NET_MESSAGE_BYTES, '\0');
+    char keys[256];
+    char status[64];
+    pollfd sources[]{{.fd = server, .events = POLLIN, .revents = 0}, {.fd = terminal ? 0 : -1, .events = POLLIN, .revents = 0}};
+    uint32_t slot{UINT32_MAX};
+    unsigned short lastState{RACER_WATCHING};
+    unsigned long long snapshots{0};
+    unsigned long long receivedBytes{0};
+    unsigned long long wholeSnapshots{0};
+    unsigned long long won{0};
+    unsigned long long lost{0};
+    bool playing{true};
+    auto sendMessage{[server](netmessage message) { send(server, &message, sizeof(message), MSG_NOSIGNAL); }};
+    while (playing and snapshots < options.maxTicks)
+    {
+        const int ready{poll(sources, 2, decoder.state == DECODE_TEXT ? -1 : static_cast<int>(ESCAPE_TIMEOUT.count()))};
+        if (ready <= 0)
+        {
+            decoder.state = DECODE_TEXT; // an escape on its own, which isn't a jump
+            continue;
+        }
+        if ((sources[1].revents & POLLIN) != 0)
+        {
+            const ssize_t count{read(0, keys, sizeof(keys))};
+            for (ssize_t key = 0; key < count; key += 1)
+            {
+                inputevent event{};
+                if (not decodeKey(decoder, keys[key], chrono::steady_clock::now(), event))
+                {
+                    continue;
+                }
+                if (isJump(event))
                 {
-                    jumpPlayer(playercharacter); 
+                    sendMessage({.kind = NET_INPUT, .key = JUMP_CHAR});
+                }
+                playing = playing and not (event.kind == KEY_TEXT and event.key == QUIT_CHAR);
+            }
+        }
+        if ((sources[0].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+        {
+            continue;
+        }
+        const ssize_t received{recv(server, message.data(), message.size(), 0)};
+        if (received <= 0)
+        {
+            break; // the server has gone
+        }
+        netmessage welcome{};
+        if (message[0] == NET_WELCOME and static_cast<size_t>(received) == sizeof(welcome))
+        {
+            memcpy(&welcome, message.data(), sizeof(welcome));
+            slot = welcome.frame;
+            continue;
+        }
+        uint32_t frame{0};
+        uint32_t base{0};
+        const size_t header{1 + sizeof(frame) + sizeof(base)};
+        if (message[0] != NET_SNAPSHOT or static_cast<size_t>(received) < header)
+        {
+            continue;
+        }
+        memcpy(&frame, &message[1], sizeof(frame));
+        memcpy(&base, &message[1 + sizeof(frame)], sizeof(base));
+        const bool haveBase{base == 0 or historyFrame[base % NET_HISTORY] == base};
+        if (frame == 0 or not haveBase or
+            not decodeDelta(string_view{message}.substr(header, static_cast<size_t>(received) - header), base == 0 ? span<const int32_t>{} : span<const int32_t>{history[base % NET_HISTORY]}, decoded) or
+            not unpackRace(decoded, view, racers) or slot >= racers.size())
+        {
+            continue;
+        }
+        history[frame % NET_HISTORY].swap(decoded);
+        historyFrame[frame % NET_HISTORY] = frame;
+        sendMessage({.kind = NET_ACK, .frame = frame});
+        snapshots += 1;
+        receivedBytes += static_cast<unsigned long long>(received);
+        wholeSnapshots += base == 0 ? 1 : 0;
 
-                    if (currentChar == JUMP_CHAR and t == 0)
-                    {
-                        jumpPlayer(playercharacter); //Can jump immediately after touching the ground by calling it again
-                    }
-                }
+        const racer &own{racers[slot]};
+        won += own.state == GAME_WON and lastState == GAME_RUNNING ? 1 : 0;
+        lost += own.state == GAME_LOST and lastState == GAME_RUNNING ? 1 : 0;
+        lastState = own.state;
+        view.playercharacter = own.playercharacter;
+        view.t = own.t;
+        view.score = own.score;
+        if (not terminal)
+        {
+            if (own.state == GAME_RUNNING and (options.autopilot ? autopilotInput(pilot, view) : botInput(view)) == JUMP_CHAR)
+            {
+                sendMessage({.kind = NET_INPUT, .key = JUMP_CHAR});
+            }
+            continue;
+        }
 
-                //This block generates a new cloud with a 1/10 chance every tick (0.1s) This means there should be a cloud roughly every second
-                chanceForCloud = chanceOfCloud(generator);
-                if (chanceForCloud == 1)
+        const bool resized{screen.rows != view.screenWidth or screen.cols != view.screenLength};
+        if (resized)
+        {
+            resizeFramebuffer(screen, view.screenWidth, view.screenLength);
+        }
+        clearFramebuffer(screen);
+        if (own.state == GAME_LOST)
+        {
+            gameOverScreen(screen, view.ticks, view.score);
+        }
+        else if (own.state == GAME_WON)
+        {
+            gameWonScreen(screen, view.ticks, view.score);
+        }
+        else
+        {
+            drawGround(screen, view.ground);
+            drawClouds(screen, view.clouds);
+            drawObstacles(screen, view.obstacles);
+            for (size_t other = 0; other < racers.size(); other += 1)
+            {
+                if (other != slot and (racers[other].state == GAME_RUNNING or racers[other].state == GAME_WON))
                 {
-                    cloud newCloud;
-                    newCloud.position.col = screenLength - 1;
-                    clouds.push_back(newCloud);
+                    blitSprite(screen, RIVAL_SPRITE, racers[other].playercharacter.position);
                 }
+            }
+            if (own.state == GAME_RUNNING)
+            {
+                drawPlayer(screen, view.playercharacter);
+            }
+            drawScore(screen, view.scoreposition, view.ticks, view.score);
+        }
+        const auto running{count_if(racers.begin(), racers.end(), [](const racer &racer) { return racer.state == GAME_RUNNING; })};
+        snprintf(status, sizeof(status), own.state == RACER_WATCHING ? "Race %d: %d racing, wait for the next one" : "Race %d: %d racing", history[frame % NET_HISTORY][0], static_cast<int>(running));
+        putText(screen, 2, view.scoreposition.col, status);
+        writeFrame(sink, presentFramebuffer(screen, resized));
+    }
 
+    close(server);
+    if (terminal)
+    {
+        closeOutput(sink);
+        MoveTo(static_cast<unsigned int>(view.screenWidth + 2), 1);
+        ShowCursor();
+        SetNonblockingReadState(false);
+        TeardownScreenAndInput();
+        return EXIT_SUCCESS;
+    }
+    cout << "Racer " << slot << ": " << snapshots << " snapshots of " << static_cast<double>(receivedBytes) / static_cast<double>(max(snapshots, 1ull)) << " bytes ("
+         << wholeSnapshots << " whole), won " << won << " races, lost " << lost << endl;
+    return EXIT_SUCCESS;
+}
 
-                //each iteration the game checks if the player is colliding with the obstacles
-                collided1 = checkCollision(ob1, playercharacter);             
-                collided2 = checkCollision(ob2, playercharacter);
-                collided3 = checkCollision(ob3, playercharacter);
+//Watches a --broadcast game for --spectate. It attaches to the ring read only, starts from the newest keyframe and copies every frame after that straight to the terminal.
+//A frame the game had started writing over while it was being copied means this spectator fell a whole ring behind, so it starts again from the newest keyframe. However
+//slow this terminal is, only this spectator waits for it. It stops once the game is over and every frame has been shown, or on q
+auto runSpectator(const settings &options) -> int
+{
+    const int fd{shm_open(spectateName(options.spectateName).c_str(), O_RDONLY | O_CLOEXEC, 0)};
+    struct stat info{};
+    const bool big{fd >= 0 and fstat(fd, &info) == 0 and static_cast<size_t>(info.st_size) > sizeof(spectateheader)};
+    const size_t size{big ? static_cast<size_t>(info.st_size) : 0};
+    void *mapping{big ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED};
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    const auto *header{static_cast<const spectateheader *>(mapping)};
+    const bool ready{mapping != MAP_FAILED and equal(begin(SPECTATE_MAGIC), end(SPECTATE_MAGIC), header->magic)};
+    atomic_thread_fence(memory_order_acquire); //pairs with the fence before startBroadcast writes the magic, so the rest of the header is read after it
+    if (not ready or header->capacity != size - sizeof(spectateheader) or (header->capacity & (header->capacity - 1)) != 0)
+    {
+        cerr << "Nobody is broadcasting [" << options.spectateName << "]" << endl;
+        return EXIT_FAILURE;
+    }
+    const span<const char> ring{static_cast<const char *>(mapping) + sizeof(spectateheader), header->capacity};
+    SetupScreenAndInput();
+    SetNonblockingReadState(true);
+    HideCursor();
 
-                if (collided1 or collided2 or collided3)
+    vector<char> frame(ring.size() / 2);
+    uint64_t at{0};
+    uint64_t expected{0};
+    bool synced{false};
+    unsigned long long shown{0};
+    unsigned long long catchUps{0};
+    bool watching{true};
+    while (watching)
+    {
+        const bool finished{header->finished.load(memory_order_acquire)}; //read first, so every frame from before the end is still shown
+        const uint64_t published{header->published.load(memory_order_acquire)};
+        if (not synced and published > 0)
+        {
+            at = header->keyframe.load(memory_order_acquire);
+            synced = true;
+            catchUps += 1;
+        }
+        while (synced and at < published)
+        {
+            spectateentry entry{};
+            copyFromRing(ring, at, reinterpret_cast<char *>(&entry), sizeof(entry));
+            const size_t length{min<size_t>(entry.length, frame.size())};
+            copyFromRing(ring, at + sizeof(entry), frame.data(), length);
+            atomic_thread_fence(memory_order_acquire);
+            const bool whole{header->claimed.load(memory_order_relaxed) - at <= ring.size()};
+            if (not whole or (expected != 0 and entry.sequence != expected and not entry.keyframe))
+            {
+                synced = false; // fell behind, start again from the newest keyframe
+                break;
+            }
+            for (size_t written = 0; written < length;)
+            {
+                const ssize_t result{write(fileno(stdout), frame.data() + written, length - written)};
+                if (result > 0)
                 {
-                    ShowCursor();
-                    SetNonblockingReadState(false);
-                    TeardownScreenAndInput();
-                    // cout << endl; // be nice to the next command
-
-                    ClearScreen();
-                    gameOverScreen( ticks);
-
-
-                    return EXIT_SUCCESS;
+                    written += static_cast<size_t>(result);
                 }
+                else if (result < 0 and errno != EINTR and errno != EAGAIN)
+                {
+                    break;
+                }
+            }
+            at += (sizeof(entry) + entry.length + 7) / 8 * 8;
+            expected = entry.sequence + 1;
+            shown += 1;
+        }
+        if (finished and synced and at >= published)
+        {
+            break;
+        }
+        //the game can't wake a process it doesn't know about, so this checks for new frames as often as the game can draw them
+        pollfd keyboard{.fd = 0, .events = POLLIN, .revents = 0};
+        char keys[64];
+        if (poll(&keyboard, 1, static_cast<int>(chrono::duration_cast<chrono::milliseconds>(RENDER_INTERVAL).count())) > 0)
+        {
+            const ssize_t count{read(0, keys, sizeof(keys))};
+            watching = count != 0 and find(keys, keys + max<ssize_t>(count, 0), QUIT_CHAR) == keys + max<ssize_t>(count, 0);
+        }
+    }
+    munmap(mapping, size);
+    cout << STOP_COLOUR;
+    ShowCursor();
+    SetNonblockingReadState(false);
+    TeardownScreenAndInput();
+    cout << endl
+         << "Watched " << shown << " frames, started from a keyframe " << catchUps << " times" << endl;
+    return EXIT_SUCCESS;
+}
+
+//Totals for one function timed by measure()
+struct benchresult
+{
+    unsigned long long operations{0};
+    unsigned long long batches{0};
+    unsigned long long bytes{0}; //escape codes produced by the frames presented between batches
+    unsigned long long allocations{0};
+    double seconds{0};
+};
 
-                
-                drawGround(ground);
+//Runs operation in batches until BENCH_SECONDS of it have been timed. prepare runs before every batch without being timed, and returns how many bytes it wrote (for the draw functions)
+//Only the operation counts towards the time and the allocations, and the cost of reading the clock is taken off every batch. maxBatch is for operations that use up what prepare set up
+template <typename Prepare, typename Operation>
+auto measure(Prepare prepare, Operation operation, unsigned long long maxBatch = ULLONG_MAX) -> benchresult
+{
+    static const double clockSeconds{[]
+                                     {
+                                         const auto start{chrono::steady_clock::now()};
+                                         for (int read = 0; read < 1000; read += 1)
+                                         {
+                                             chrono::steady_clock::now();
+                                         }
+                                         return chrono::duration<double>(chrono::steady_clock::now() - start).count() / 1000;
+                                     }()};
+    benchresult result{};
+    unsigned long long batch{1};
+    while (result.seconds < BENCH_SECONDS)
+    {
+        result.bytes += prepare();
+        const auto allocationsBefore{heapAllocations.load(memory_order_relaxed)};
+        const auto start{chrono::steady_clock::now()};
+        for (unsigned long long op = 0; op < batch; op += 1)
+        {
+            operation();
+        }
+        const double seconds{chrono::duration<double>(chrono::steady_clock::now() - start).count()};
+        result.allocations += heapAllocations.load(memory_order_relaxed) - allocationsBefore;
+        result.seconds += max(seconds - clockSeconds, 0.0);
+        result.operations += batch;
+        result.batches += 1;
+        if (seconds < BENCH_BATCH_SECONDS and batch < maxBatch)
+        {
+            batch *= 2;
+        }
+    }
+    return result;
+}
 
-                drawPlayer(playercharacter);
+//Prints one line of --bench. bytes/frame only means something for the draw functions, the others show a dash
+auto reportBench(const char *name, const benchresult &result, bool drawsFrames) -> void
+{
+    char bytes[32]{"-"};
+    if (drawsFrames)
+    {
+        snprintf(bytes, sizeof(bytes), "%llu", result.bytes / max(result.batches, 1ull));
+    }
+    char line[160]{};
+    snprintf(line, sizeof(line), "  %-18s %12.1f ns/op %10s bytes/frame %10.3f allocs/op", name, result.seconds * 1e9 / static_cast<double>(result.operations), bytes,
+             static_cast<double>(result.allocations) / static_cast<double>(result.operations));
+    cout << line << endl;
+}
 
-                drawClouds(clouds);
-                moveClouds(clouds);
+//Times each of the functions a tick spends its time in, on their own, for every screen size and entity count in the BENCH_ constants. Frames are diffed like in the game
+//but the escape codes are thrown away instead of written, so the numbers are only our code and not the terminal
+auto runBench(const settings &options) -> int
+{
+    volatile bool sink{false}; //keeps the compiler from throwing away collision checks whose answer isn't used
+    vector<levelentity> levelObstacles{};
+    vector<levelentity> levelScenery{};
+    generateLevel(options.seed, BENCH_LEVEL_LENGTH, levelObstacles, levelScenery);
+    const vector<int32_t> obstacleIndex{buildIndex(levelObstacles)};
+    const vector<int32_t> sceneryIndex{buildIndex(levelScenery)};
+    const levelfile level{BENCH_LEVEL_LENGTH, levelObstacles, obstacleIndex, levelScenery, sceneryIndex};
+    for (size_t screenSize = 0; screenSize < size(BENCH_ROWS); screenSize += 1)
+    {
+        for (size_t load = 0; load < size(BENCH_CLOUDS); load += 1)
+        {
+            const int screenWidth{BENCH_ROWS[screenSize]};
+            const int screenLength{BENCH_COLS[screenSize]};
+            world game{.screenWidth = screenWidth, .screenLength = screenLength};
+            game.generator.seed(options.seed);
+            setupWorld(game, BENCH_OBSTACLES[load], BENCH_CLOUDS[load]);
+            const world start{game};
+            framebuffer screen{};
+            cout << "Bench " << screenWidth << "x" << screenLength << " with " << game.clouds.count << " clouds and " << game.obstacles.count << " obstacles" << endl;
 
-                drawObstacles(ob1);
-                drawObstacles(ob2);
-                drawObstacles(ob3);
+            //The draw functions get a new frame before every batch: the last frame is diffed (which is what bytes/frame counts), then everything moves one tick.
+            //Clouds are topped back up once half of them have left so the count stays near what the line says
+            auto nextFrame{[&]() -> size_t
+                           {
+                               const size_t bytes{presentFramebuffer(screen).size()};
+                               clearFramebuffer(screen);
+                               if (game.clouds.count < start.clouds.count / 2)
+                               {
+                                   game.clouds = start.clouds;
+                               }
+                               moveClouds(game.clouds);
+                               game.scratch.used = 0;
+                               moveObstacles(game);
+                               return bytes;
+                           }};
+            auto drawOnly{[&](const char *name, auto draw)
+                          {
+                              resizeFramebuffer(screen, screenWidth, screenLength);
+                              reportBench(name, measure(nextFrame, draw), true);
+                          }};
+            drawOnly("drawClouds", [&] { drawClouds(screen, game.clouds); });
+            drawOnly("drawObstacles", [&] { drawObstacles(screen, game.obstacles); });
+            drawOnly("drawGround", [&] { drawGround(screen, game.ground); });
 
-                moveObstacles(ob1);
-                moveObstacles(ob2);
-                moveObstacles(ob3);
+            //A whole frame onto a blank terminal, encoded and given to the null sink. One frame a batch, since presenting the same frame again would have nothing to send.
+            //The bytes reported for each batch are the frame from the batch before
+            outputsink discard{.kind = OUTPUT_NULL};
+            reportBench("presentFramebuffer", measure([&]() -> size_t
+                                                      {
+                                                          const size_t bytes{screen.encoder.bytes.size()};
+                                                          fill(screen.front.begin(), screen.front.end(), cell{});
+                                                          clearFramebuffer(screen);
+                                                          drawWorld(screen, game, game.playercharacter.position, 0);
+                                                          return bytes;
+                                                      },
+                                                      [&] { writeFrame(discard, presentFramebuffer(screen)); }, 1),
+                        true);
 
-                drawScore( scoreposition, ticks );
+            //Batches of moveClouds start from the same clouds and are kept short, otherwise they would mostly be timing an empty sky
+            reportBench("moveClouds", measure([&]() -> size_t { game.clouds = start.clouds; return 0; }, [&] { moveClouds(game.clouds); }, 8), false);
+            reportBench("moveObstacles", measure([]() -> size_t { return 0; },
+                                                 [&]
+                                                 {
+                                                     game.scratch.used = 0;
+                                                     moveObstacles(game);
+                                                 }),
+                        false);
 
-        
+            //The player stands in the middle of the ground so the obstacles that have been moved around above are on both sides of it
+            game.playercharacter.position = {screenWidth - 1, screenLength / 2};
+            size_t next{0};
+            reportBench("checkCollision", measure([]() -> size_t { return 0; },
+                                                  [&]
+                                                  {
+                                                      sink = checkCollision(game, next);
+                                                      next = next + 1 == game.obstacles.count ? 0 : next + 1;
+                                                  }),
+                        false);
+            reportBench("checkCollisions", measure([]() -> size_t { return 0; }, [&] { sink = checkCollisions(game); }), false);
 
-                bool finished = checkWon(playercharacter);
+            reportBench("jumpPlayer", measure(
+                                          [&]() -> size_t
+                                          {
+                                              game.playercharacter.position = {screenWidth - 1, 0};
+                                              game.t = 0;
+                                              return 0;
+                                          },
+                                          [&] { jumpPlayer(game); }),
+                        false);
+            autopilot pilot{};
+            reportBench("autopilotInput", measure(
+                                              [&]() -> size_t
+                                              {
+                                                  game.playercharacter.position = {screenWidth - 1, 0};
+                                                  game.t = 0;
+                                                  return 0;
+                                              },
+                                              [&] { sink = autopilotInput(pilot, game) == JUMP_CHAR; }),
+                        false);
 
-                if(finished)
-                {
-                        ShowCursor();
-                        SetNonblockingReadState(false);
-                        TeardownScreenAndInput();
-                        // cout << endl; // be nice to the next command
+            //The camera moves along the whole level, so each view is of a part of it that hasn't been seen for a while
+            world travelling{.screenWidth = screenWidth, .screenLength = screenLength, .level = &level};
+            setupWorld(travelling, 0, 0);
+            reportBench("viewLevel", measure([]() -> size_t { return 0; },
+                                             [&]
+                                             {
+                                                 travelling.camera = (travelling.camera + BENCH_LEVEL_LENGTH / 1009) % BENCH_LEVEL_LENGTH;
+                                                 viewLevel(travelling);
+                                             }),
+                        false);
+        }
+    }
 
-                        ClearScreen();
-                        gameWonScreen( ticks);
+    //A whole batch stepped at once on every thread, with the same policy as the bot but read off the observations like a trained one would
+    dinosaurenv *env{dinosaurCreate(ENV_BENCH_GAMES, BENCH_ROWS[0], BENCH_COLS[0], BENCH_OBSTACLES[0], options.threads)};
+    vector<float> observations(ENV_BENCH_GAMES * DINOSAUR_OBSERVATION_SIZE);
+    vector<float> rewards(ENV_BENCH_GAMES);
+    vector<uint8_t> dones(ENV_BENCH_GAMES);
+    vector<uint8_t> actions(ENV_BENCH_GAMES);
+    dinosaurReset(env, options.seed, observations.data());
+    cout << "Bench dinosaurStep on " << ENV_BENCH_GAMES << " games of " << BENCH_ROWS[0] << "x" << BENCH_COLS[0] << " with " << env->workers.size() + 1 << " threads" << endl;
+    const benchresult stepped{measure([]() -> size_t { return 0; },
+                                      [&]
+                                      {
+                                          for (size_t game = 0; game < ENV_BENCH_GAMES; game += 1)
+                                          {
+                                              const float *observation{&observations[game * DINOSAUR_OBSERVATION_SIZE]};
+                                              const bool grounded{observation[1] == 0 or observation[1] >= 6};
+                                              actions[game] = grounded and observation[2] >= 0 and observation[2] <= BOT_JUMP_GAP * observation[3];
+                                          }
+                                          dinosaurStep(env, actions.data(), observations.data(), rewards.data(), dones.data());
+                                      })};
+    reportBench("dinosaurStep", stepped, false);
+    cout << "  " << static_cast<unsigned long long>(static_cast<double>(stepped.operations * ENV_BENCH_GAMES) / max(stepped.seconds, 1e-9)) << " game steps/sec" << endl;
+    dinosaurDestroy(env);
+    return EXIT_SUCCESS;
+}
 
-                        return EXIT_SUCCESS;
+//Plays a recorded trace back without a terminal as fast as possible. The world is hashed after every tick and checked against the hashes in the trace, so the first tick where the game went differently gets reported
+auto runReplay(const settings &options) -> int
+{
+    ifstream file{options.replayPath, ios::binary};
+    vector<char> trace{istreambuf_iterator<char>(file), istreambuf_iterator<char>()};
+    traceheader header{};
+    if (trace.size() < sizeof(header) or not equal(begin(TRACE_MAGIC), end(TRACE_MAGIC), trace.begin()))
+    {
+        cerr << "[" << options.replayPath << "] is not a trace" << endl;
+        return EXIT_FAILURE;
+    }
+    memcpy(&header, trace.data(), sizeof(header));
+    //a level isn't in the trace, only its length, which is enough to catch being given the wrong one
+    if (header.levelLength != 0 and (options.level == nullptr or options.level->length != header.levelLength))
+    {
+        cerr << "[" << options.replayPath << "] was played on a level " << header.levelLength << " columns long, give the same one with --level" << endl;
+        return EXIT_FAILURE;
+    }
+    world game{.screenWidth = header.rows, .screenLength = header.cols, .endless = header.endless != 0, .level = header.levelLength != 0 ? options.level : nullptr};
+    game.generator.seed(header.seed);
+    setupWorld(game, header.obstacles, header.clouds);
 
-                }
+    size_t next{sizeof(header)};
+    auto startTimestamp{chrono::steady_clock::now()};
+    unsigned short state{GAME_RUNNING};
+    while (next < trace.size())
+    {
+        uint32_t tick;
+        if (next + sizeof(tick) + 1 > trace.size())
+        {
+            cerr << "[" << options.replayPath << "] is truncated after tick " << game.ticks << endl;
+            return EXIT_FAILURE;
+        }
+        memcpy(&tick, &trace[next], sizeof(tick));
+        unsigned char kind{static_cast<unsigned char>(trace[next + sizeof(tick)])};
+        next += sizeof(tick) + 1;
+        //hashes and resizes carry 8 bytes after the header, everything else 1, and a cut off trace mustn't be read past its end
+        const size_t payload{kind == TRACE_HASH or kind == TRACE_RESIZE ? sizeof(uint64_t) : 1};
+        if (next + payload > trace.size())
+        {
+            cerr << "[" << options.replayPath << "] is truncated at tick " << tick << endl;
+            return EXIT_FAILURE;
+        }
 
-                // Clear inputs in preparation for the next iteration
-                startTimestamp = endTimestamp;
-                currentChar = NULL_CHAR;
-                currentCommand.clear();
+        //run the ticks that had no input up to the one this record is about. Input is recorded before the hash of the same tick, so only an input record runs its own tick
+        const uint32_t lastTickBefore{kind == TRACE_INPUT ? tick - 1 : tick};
+        while (game.ticks < lastTickBefore and state == GAME_RUNNING)
+        {
+            state = stepWorld(game, NULL_CHAR);
+        }
+        if (kind == TRACE_INPUT and state == GAME_RUNNING)
+        {
+            state = stepWorld(game, trace[next]);
+        }
+        else if (kind == TRACE_HASH)
+        {
+            uint64_t expected;
+            memcpy(&expected, &trace[next], sizeof(expected));
+            next += sizeof(expected) - 1;
+            if (hashWorld(game) != expected)
+            {
+                cout << "Replay diverged at tick " << tick << endl;
+                return EXIT_FAILURE;
             }
-            // Depending on the blocking mode, either read in one character or a string (character by character)
-            if (showCommandline)
+        }
+        else if (kind == TRACE_RESIZE)
+        {
+            uint64_t size;
+            memcpy(&size, &trace[next], sizeof(size));
+            next += sizeof(size) - 1;
+            resizeWorld(game, static_cast<int>(size >> 32), static_cast<int>(size & 0xffffffff));
+        }
+        else if (kind == TRACE_END)
+        {
+            auto seconds{chrono::duration<double>(chrono::steady_clock::now() - startTimestamp).count()};
+            bool matched{game.ticks == tick and state == static_cast<unsigned short>(trace[next])};
+            cout << "Replayed " << game.ticks << " ticks in " << seconds << "s, score " << game.score << ", "
+                 << (matched ? "matches the recording" : "but the recording ended differently") << endl;
+            return matched ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        next += 1;
+    }
+    cout << "Trace ended without an end record after " << game.ticks << " ticks" << endl;
+    return EXIT_FAILURE;
+}
+
+//Reads the command line. Anything unrecognised prints how to use the program and stops it
+auto parseSettings(int argc, char *argv[], settings &options) -> bool
+{
+    for (int i = 1; i < argc; i += 1)
+    {
+        string_view argument{argv[i]};
+        bool hasValue{i + 1 < argc};
+        if (argument == "--headless")
+        {
+            options.headless = true;
+        }
+        else if (argument == "--endless")
+        {
+            options.endless = true;
+        }
+        else if (argument == "--bench")
+        {
+            options.bench = true;
+        }
+        else if (argument == "--autopilot")
+        {
+            options.autopilot = true;
+        }
+        else if (argument == "--batch" and hasValue)
+        {
+            options.batchGames = strtoull(argv[++i], nullptr, 10);
+            if (options.batchGames > BATCH_RANGE_END)
             {
-                while (read(0, &currentChar, 1) == 1 && (currentChar != '\n'))
-                {
-                    cout << currentChar << flush; // the flush is important since we are in non-echoing mode
-                    currentCommand += currentChar;
-                }
-                cerr << "Received command [" << currentCommand << "]" << endl;
-                currentChar = NULL_CHAR;
+                cerr << "A batch can be at most " << BATCH_RANGE_END << " games" << endl;
+                return false;
             }
-            else
+        }
+        else if (argument == "--threads" and hasValue)
+        {
+            options.threads = static_cast<unsigned int>(atoi(argv[++i]));
+        }
+        else if (argument == "--rows" and hasValue)
+        {
+            options.rows = atoi(argv[++i]);
+        }
+        else if (argument == "--cols" and hasValue)
+        {
+            options.cols = atoi(argv[++i]);
+        }
+        else if (argument == "--ticks" and hasValue)
+        {
+            options.maxTicks = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--input" and hasValue)
+        {
+            options.script = argv[++i];
+        }
+        else if (argument == "--obstacles" and hasValue)
+        {
+            options.obstacles = static_cast<unsigned int>(atoi(argv[++i]));
+        }
+        else if (argument == "--clouds" and hasValue)
+        {
+            options.clouds = static_cast<unsigned int>(atoi(argv[++i]));
+        }
+        else if (argument == "--seed" and hasValue)
+        {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--record" and hasValue)
+        {
+            options.recordPath = argv[++i];
+        }
+        else if (argument == "--replay" and hasValue)
+        {
+            options.replayPath = argv[++i];
+        }
+        else if (argument == "--log-level" and hasValue)
+        {
+            const string_view level{argv[++i]};
+            const auto named{find(begin(LOG_LEVEL_NAMES), end(LOG_LEVEL_NAMES), level)};
+            if (named == end(LOG_LEVEL_NAMES))
             {
-                read(0, &currentChar, 1);
+                cerr << "Unknown log level [" << level << "], use DEBUG, INFO, WARN or ERROR" << endl;
+                return false;
             }
+            options.logLevel = static_cast<unsigned char>(named - begin(LOG_LEVEL_NAMES));
+        }
+        else if (argument == "--profile" and hasValue)
+        {
+            options.profilePath = argv[++i];
+        }
+        else if (argument == "--output" and hasValue)
+        {
+            options.outputPath = argv[++i];
+        }
+        else if (argument == "--cast" and hasValue)
+        {
+            options.castPath = argv[++i];
+        }
+        else if (argument == "--serve" and hasValue)
+        {
+            options.servePath = argv[++i];
+        }
+        else if (argument == "--join" and hasValue)
+        {
+            options.joinPath = argv[++i];
+        }
+        else if (argument == "--broadcast" and hasValue)
+        {
+            options.broadcastName = argv[++i];
+        }
+        else if (argument == "--spectate" and hasValue)
+        {
+            options.spectateName = argv[++i];
+        }
+        else if (argument == "--level" and hasValue)
+        {
+            options.levelPath = argv[++i];
+        }
+        else if (argument == "--make-level" and hasValue)
+        {
+            options.makeLevelPath = argv[++i];
+        }
+        else if (argument == "--level-length" and hasValue)
+        {
+            options.levelLength = strtoll(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            cerr << "usage: " << argv[0] << " [--seed N] [--endless | --level FILE] [--obstacles N] [--clouds N] [--log-level LEVEL] [--profile FILE] [--output null | FILE] [--cast FILE] [--broadcast NAME] [--record FILE | --replay FILE | --spectate NAME | --serve SOCKET | --join SOCKET [--headless] | --make-level FILE [--level-length COLUMNS] | --bench | --batch GAMES [--threads N] | --headless] [--rows N] [--cols N] [--ticks N] [--autopilot | --input KEYS]" << endl;
+            return false;
+        }
+    }
+    if (options.endless and not options.levelPath.empty())
+    {
+        cerr << "A level has an end, it can't be played with --endless" << endl;
+        return false;
+    }
+    if (options.autopilot and not options.script.empty())
+    {
+        cerr << "The autopilot picks its own keys, it can't be given --input" << endl;
+        return false;
+    }
+    if (not options.servePath.empty() and (options.endless or not options.levelPath.empty()))
+    {
+        cerr << "A race is run on a single screen, it can't be played with --endless or --level" << endl;
+        return false;
+    }
+    if (options.rows < 30 or options.cols < 100)
+    {
+        cerr << "The screen must be at least 30 by 100 to run this game" << endl;
+        return false;
+    }
+    return true;
+}
+
+//The library is everything but this, see DinosaurEnv.h
+#ifndef DINOSAUR_LIBRARY
+auto main(int argc, char *argv[]) -> int
+{
+    settings options{};
+    if (not parseSettings(argc, argv, options))
+    {
+        return EXIT_FAILURE;
+    }
+    startLogging(options.logLevel);
+    if (not options.profilePath.empty())
+    {
+#ifndef DINOSAUR_NO_PROFILING
+        startProfiling(options.profilePath);
+#else
+        cerr << "Profiling was compiled out of this build, [" << options.profilePath << "] won't be written" << endl;
+#endif
+    }
+    if (not options.makeLevelPath.empty())
+    {
+        return runMakeLevel(options);
+    }
+    levelfile level{};
+    if (not options.levelPath.empty())
+    {
+        if (not openLevel(level, options.levelPath))
+        {
+            return EXIT_FAILURE;
         }
-        // Tidy Up and Close Down
+        options.level = &level;
+    }
+    if (not options.replayPath.empty())
+    {
+        return runReplay(options);
+    }
+    if (not options.spectateName.empty())
+    {
+        return runSpectator(options);
+    }
+    if (not options.servePath.empty())
+    {
+        return runServer(options);
+    }
+    if (not options.joinPath.empty())
+    {
+        return runClient(options);
+    }
+    if (options.bench)
+    {
+        return runBench(options);
+    }
+    if (options.batchGames > 0)
+    {
+        return runBatch(options);
+    }
+    if (options.headless)
+    {
+        return runHeadless(options);
+    }
+
+    // Set Up the system to receive input
+    SetupScreenAndInput();
+
+    // Check that the terminal size is large enough for our fishies. The kernel knows it straight away, asking the terminal is only for when it doesn't
+    watchResizes();
+    position TERMINAL_SIZE{windowSize()};
+    if (TERMINAL_SIZE.row == 0)
+    {
+        TERMINAL_SIZE = GetTerminalSize(TERMINAL_REPLY_TIMEOUT);
+    }
+    if (TERMINAL_SIZE.row == 0)
+    {
+        logText(LOG_WARN, "Terminal did not say how big it is, assuming the smallest size", "");
+        TERMINAL_SIZE = {SCREEN_MIN_ROWS, SCREEN_MIN_COLS};
+    }
+    if ((TERMINAL_SIZE.row < SCREEN_MIN_ROWS) or (TERMINAL_SIZE.col < SCREEN_MIN_COLS))
+    {
         ShowCursor();
-        SetNonblockingReadState(false);
         TeardownScreenAndInput();
-        cout << endl; // be nice to the next command
-        return EXIT_SUCCESS;
+        cout << endl
+             << "Terminal window must be at least 30 by 100 to run this game" << endl;
+        return EXIT_FAILURE;
+    }
+    // State Variables
+    world game{.screenWidth = TERMINAL_SIZE.row, .screenLength = TERMINAL_SIZE.col, .endless = options.endless, .level = options.level};
+    game.generator.seed(options.seed);
+    setupWorld(game, options.obstacles, options.clouds);
+    framebuffer screen{};
+    resizeFramebuffer(screen, game.screenWidth, game.screenLength);
+    logNumber(LOG_INFO, "Seed", options.seed);
+
+    tracewriter trace{};
+    if (not options.recordPath.empty() and not openTrace(trace, options.recordPath, {.seed = options.seed, .rows = game.screenWidth, .cols = game.screenLength, .obstacles = static_cast<int32_t>(options.obstacles), .clouds = static_cast<int32_t>(options.clouds), .endless = options.endless, .levelLength = options.level != nullptr ? options.level->length : 0}))
+    {
+        logText(LOG_ERROR, "Error opening trace", options.recordPath);
+    }
+
+    bool allowBackgroundProcessing{true};
+    int elapsedTimePerTick{100}; // Every 0.1s check on things. The screen is drawn more often than that, see renderFrames
+    SetNonblockingReadState(allowBackgroundProcessing);
+    ClearScreen();
+    HideCursor();
+
+    // An endless level has its chunks made ahead on a thread of their own, so moving on to the next one doesn't hold up a tick
+    levelstream levels{};
+    if (game.endless)
+    {
+        startLevels(levels, game);
+    }
+
+    // Input, simulation and drawing each get their own thread, so a terminal that stalls on output only holds up the drawing
+    pipeline pipe{};
+    pipe.wake = eventfd(0, EFD_CLOEXEC);
+    for (snapshot &frame : pipe.frames)
+    {
+        frame.game = game; // sizes every snapshot up front so handing one over never allocates
+        frame.playerBefore = game.playercharacter.position;
+    }
+    thread simulation{simulate, ref(pipe), ref(game), ref(trace), elapsedTimePerTick, options.autopilot};
+    thread input{readInput, ref(pipe)};
+    outputsink sink{openOutput(options.outputPath)};
+    castrecorder cast{};
+    if (not options.castPath.empty())
+    {
+        if (startCasting(cast, options.castPath, game.screenWidth, game.screenLength, options.seed))
+        {
+            sink.cast = &cast;
+        }
+        else
+        {
+            logText(LOG_ERROR, "Error opening recording", options.castPath);
+        }
+    }
+    broadcaster broadcast{};
+    if (not options.broadcastName.empty())
+    {
+        if (startBroadcast(broadcast, options.broadcastName))
+        {
+            sink.broadcast = &broadcast;
+        }
+        else
+        {
+            logText(LOG_ERROR, "Error starting the broadcast", options.broadcastName);
+        }
+    }
+    const unsigned short state{renderFrames(pipe, screen, sink, chrono::milliseconds{elapsedTimePerTick})};
+    stopBroadcast(broadcast);
+    stopCasting(cast);
+    closeOutput(sink);
+    simulation.join();
+    input.join();
+    stopLevels(levels);
+    close(pipe.wake);
 
+    // Tidy Up and Close Down
+    ShowCursor();
+    SetNonblockingReadState(false);
+    TeardownScreenAndInput();
+    if (state == GAME_RUNNING)
+    {
+        cout << endl; // be nice to the next command
+    }
+    return EXIT_SUCCESS;
 }
+#endif
@@ -0,0 +1,40 @@
+// The game as a batch of environments to train jump policies against, without a terminal
+// build the library with: clang++ -std=c++20 -Wall -Werror -Wextra -Wpedantic -O2 -pthread -fPIC -fvisibility=hidden -shared -DDINOSAUR_LIBRARY -o libdinosaur.so Dinosaur.cpp
+// and link against it with: cc -o train train.c -L. -ldinosaur
+//
+// Every game in a batch is independent and steps once per call to dinosaurStep. A game that ends starts again straight away from the next seed, and its done flag
+// says so for that step. None of these allocate after dinosaurCreate, and a batch must only be used from one thread at a time
+
+#ifndef DINOSAUR_ENV_H
+#define DINOSAUR_ENV_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define DINOSAUR_NEAREST 3 //obstacles each observation has, nearest first
+#define DINOSAUR_OBSERVATION_SIZE (2 + 2 * DINOSAUR_NEAREST) //floats per game: how high the player is, how far through a jump (t), then each obstacle's distance and velocity
+#define DINOSAUR_EXPORT __attribute__((visibility("default")))      //the library is built with everything else hidden, so these four are all a host can see or clash with
+
+    typedef struct dinosaurenv dinosaurenv;
+
+    //A batch of games on rows by cols screens (at least 30 by 100) with obstacles obstacles each, stepped on threads threads (0 for every core). Null if it can't be made
+    DINOSAUR_EXPORT dinosaurenv *dinosaurCreate(uint32_t games, int32_t rows, int32_t cols, uint32_t obstacles, uint32_t threads);
+
+    //Starts every game again, game i of episode e from seed's (e * games + i)th seed, and writes games * DINOSAUR_OBSERVATION_SIZE floats to observations
+    DINOSAUR_EXPORT void dinosaurReset(dinosaurenv *env, uint64_t seed, float *observations);
+
+    //Steps every game once, jumping where actions is non-zero. Each buffer has one entry per game (observations has DINOSAUR_OBSERVATION_SIZE), and any of them can be null.
+    //The reward is the score the step made, plus 1 for winning or minus 1 for losing. A game still going after 100000 steps is done without either
+    DINOSAUR_EXPORT void dinosaurStep(dinosaurenv *env, const uint8_t *actions, float *observations, float *rewards, uint8_t *dones);
+
+    DINOSAUR_EXPORT void dinosaurDestroy(dinosaurenv *env);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif